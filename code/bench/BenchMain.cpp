@@ -0,0 +1,64 @@
+#include "Benchmark.h"
+#include "Data/JobSystem.h"
+#include "Data/Resources.h"
+#include "Core/Materials/Materials.h"
+#include "Core/Stats/StatManager.h"
+#include "Core/Monster/BaseDrivers.h"
+#include "Core/Monster/Monster.h"
+#include <thread>
+
+/*
+	RogueCppBench - headless entry point.
+
+	Mirrors the resource setup from RoguelikeFramework.cpp, minus anything that needs a renderer,
+	then boots a seeded game on this thread and runs every registered scenario against it.
+*/
+
+void SetupBenchResources()
+{
+	Resources::Initialize();
+
+	std::vector<BodyTileDefinitions> bodyParts;
+	bodyParts.push_back({ '@', Color(255,255,0) });
+	Resources::SetResource("MonsterDefinition", "Player", std::make_shared<MonsterDefinition>(new RectangularBodyDriver(Vec2(3, 3)), std::vector<MovementDriver*>({ new WalkingDriver(), new MiningDriver() }), bodyParts));
+
+	Resources::Register("Mat", &Resources::PackMaterial, &Resources::LoadMaterial);
+	Resources::Register("Reaction", &Resources::PackReaction, &Resources::LoadReaction);
+	Resources::Register("Stats", &Resources::PackStatDefinition, Resources::LoadStatDefinition);
+}
+
+int main(int argc, char* argv[])
+{
+	Bench::Options options = Bench::ParseOptions(argc, argv);
+
+	uint maxThreads = std::thread::hardware_concurrency();
+	if (maxThreads < 3)
+	{
+		maxThreads = 3; //Always keep at least one job thread around
+	}
+
+	uint reservedThreads = 2; //1 thread for main, 1 for the game (which is also main, here - keep the count the same as the real client)
+	Jobs::Initialize(maxThreads - reservedThreads);
+	SetupBenchResources();
+
+	RegisterLOSBenchmarks();
+	RegisterMapBenchmarks();
+	RegisterSaveBenchmarks();
+	RegisterViewBenchmarks();
+
+	Game game;
+	Bench::Context context(game, options);
+
+	if (!options.m_list)
+	{
+		PRINT_ERR("Starting seeded game (seed %u)...", options.m_seed);
+		context.BeginSeededGame(options.m_seed);
+	}
+
+	Bench::RunAll(context);
+
+	Resources::Shutdown();
+	Jobs::Shutdown();
+
+	return EXIT_SUCCESS;
+}
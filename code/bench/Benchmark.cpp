@@ -0,0 +1,213 @@
+#include "Benchmark.h"
+#include "Map/Map.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <numeric>
+
+namespace Bench
+{
+	std::vector<Scenario>& Scenarios()
+	{
+		static std::vector<Scenario> scenarios;
+		return scenarios;
+	}
+
+	Context::Context(Game& game, const Options& options) : m_game(game), m_options(options), m_random(options.m_seed)
+	{
+
+	}
+
+	void Context::BeginSeededGame(uint seed)
+	{
+		Input input;
+		input.Set<EInputType::BeginSeededGame>(seed);
+		m_game.HandleInputImmediate(input);
+		DrainOutputs();
+		m_random.seed(seed);
+	}
+
+	Location Context::RandomLocationNearPlayer(int radius)
+	{
+		return RandomLocation(radius, GetPlayer()->GetLocation());
+	}
+
+	Location Context::RandomLocation(int radius, Location center)
+	{
+		std::uniform_int_distribution<int> offset(-radius, radius);
+		Vec4 position = center.GetVector() + Vec4(offset(m_random), offset(m_random));
+		Location location = Location(Vec4::WrapPosition(position));
+		StreamAround(location);
+		return location;
+	}
+
+	void Context::StreamAround(Location location, int chunkRadius)
+	{
+		GetMap()->TriggerStreamingAroundLocation(location, Vec4(chunkRadius, chunkRadius, 0, 0));
+		GetMap()->WaitForStreaming();
+	}
+
+	int Context::DrainOutputs()
+	{
+		int count = 0;
+		while (m_game.HasNextOutput())
+		{
+			m_game.PopNextOutput();
+			count++;
+		}
+		return count;
+	}
+
+	void Register(const Scenario& scenario)
+	{
+		Scenarios().push_back(scenario);
+	}
+
+	const std::vector<Scenario>& GetScenarios()
+	{
+		return Scenarios();
+	}
+
+	Options ParseOptions(int argc, char* argv[])
+	{
+		Options options;
+		for (int i = 1; i < argc; i++)
+		{
+			bool hasValue = (i + 1) < argc;
+			if (strcmp(argv[i], "--seed") == 0 && hasValue)
+			{
+				options.m_seed = (uint)strtoul(argv[++i], nullptr, 0);
+			}
+			else if (strcmp(argv[i], "--iterations") == 0 && hasValue)
+			{
+				options.m_iterations = atoi(argv[++i]);
+				if (options.m_iterations < 1)
+				{
+					PRINT_ERR("--iterations has to be at least 1, got '%s'", argv[i]);
+					exit(EXIT_FAILURE);
+				}
+			}
+			else if (strcmp(argv[i], "--warmup") == 0 && hasValue)
+			{
+				options.m_warmup = atoi(argv[++i]);
+			}
+			else if (strcmp(argv[i], "--filter") == 0 && hasValue)
+			{
+				options.m_filter = argv[++i];
+			}
+			else if (strcmp(argv[i], "--list") == 0)
+			{
+				options.m_list = true;
+			}
+			else
+			{
+				PRINT_ERR("Usage: %s [--seed N] [--iterations N] [--warmup N] [--filter prefix] [--list]", argv[0]);
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		return options;
+	}
+
+	bool MatchesFilter(const std::string& name, const std::string& filter)
+	{
+		return filter.empty() || name.rfind(filter, 0) == 0;
+	}
+
+	Result Run(Context& context, const Scenario& scenario)
+	{
+		ROGUE_PROFILE_SECTION("Bench::Run");
+		const Options& options = context.GetOptions();
+		int iterations = options.m_iterations > 0 ? options.m_iterations : scenario.m_defaultIterations;
+
+		if (scenario.m_setup)
+		{
+			scenario.m_setup(context);
+		}
+
+		for (int i = 0; i < options.m_warmup; i++)
+		{
+			scenario.m_run(context, i);
+		}
+
+		std::vector<double> samples;
+		samples.reserve(iterations);
+
+		Result result;
+		result.m_name = scenario.m_name;
+		result.m_itemName = scenario.m_itemName;
+		result.m_iterations = iterations;
+
+		for (int i = 0; i < iterations; i++)
+		{
+			Clock::time_point start = Clock::now();
+			result.m_items += scenario.m_run(context, i);
+			samples.push_back(SecondsSince(start));
+		}
+
+		if (scenario.m_teardown)
+		{
+			scenario.m_teardown(context);
+		}
+
+		std::sort(samples.begin(), samples.end());
+		result.m_totalSeconds = std::accumulate(samples.begin(), samples.end(), 0.0);
+		result.m_min = samples.front();
+		result.m_max = samples.back();
+		result.m_mean = result.m_totalSeconds / samples.size();
+		result.m_p50 = Percentile(samples, 0.50);
+		result.m_p90 = Percentile(samples, 0.90);
+		result.m_p99 = Percentile(samples, 0.99);
+
+		return result;
+	}
+
+	void RunAll(Context& context)
+	{
+		const Options& options = context.GetOptions();
+		for (const Scenario& scenario : GetScenarios())
+		{
+			if (!MatchesFilter(scenario.m_name, options.m_filter))
+			{
+				continue;
+			}
+
+			if (options.m_list)
+			{
+				printf("%s\n", scenario.m_name.c_str());
+				continue;
+			}
+
+			PRINT_ERR("Running %s...", scenario.m_name.c_str());
+			PrintResult(Run(context, scenario));
+		}
+	}
+
+	void PrintResult(const Result& result)
+	{
+		static constexpr double toMicro = 1000000.0;
+		double itemsPerSecond = result.m_totalSeconds > 0 ? result.m_items / result.m_totalSeconds : 0;
+		double iterationsPerSecond = result.m_totalSeconds > 0 ? result.m_iterations / result.m_totalSeconds : 0;
+
+		printf("{\"scenario\":\"%s\",\"iterations\":%d,\"unit\":\"us\",\"min\":%.3f,\"mean\":%.3f,\"p50\":%.3f,\"p90\":%.3f,\"p99\":%.3f,\"max\":%.3f,"
+			"\"iterations_per_second\":%.2f,\"item\":\"%s\",\"items\":%zu,\"items_per_second\":%.2f}\n",
+			result.m_name.c_str(), result.m_iterations,
+			result.m_min * toMicro, result.m_mean * toMicro, result.m_p50 * toMicro, result.m_p90 * toMicro, result.m_p99 * toMicro, result.m_max * toMicro,
+			iterationsPerSecond, result.m_itemName.c_str(), result.m_items, itemsPerSecond);
+		fflush(stdout);
+	}
+
+	//Nearest-rank percentile over already sorted samples
+	double Percentile(std::vector<double>& sortedSamples, double percentile)
+	{
+		ASSERT(!sortedSamples.empty());
+		size_t rank = (size_t)std::ceil(percentile * sortedSamples.size());
+		rank = std::clamp<size_t>(rank, 1, sortedSamples.size());
+		return sortedSamples[rank - 1];
+	}
+
+	double SecondsSince(Clock::time_point start)
+	{
+		return std::chrono::duration<double>(Clock::now() - start).count();
+	}
+}
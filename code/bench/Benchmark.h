@@ -0,0 +1,104 @@
+#pragma once
+#include "Game/Game.h"
+#include <chrono>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+/*
+	Headless benchmark harness.
+
+	Scenarios register a setup step (untimed) and a run step (timed once per iteration).
+	Each run step reports how many items it processed, so throughput can be given in
+	something more meaningful than iterations (tiles revealed, chunks loaded, bytes written).
+
+	Results are printed as one JSON object per line on stdout, so they can be diffed or
+	piped into other tools. Anything human-facing goes to stderr.
+*/
+
+namespace Bench
+{
+	using Clock = std::chrono::steady_clock;
+
+	struct Options
+	{
+		uint m_seed = 420;
+		int m_iterations = 0; //0 - use the scenario default
+		int m_warmup = 3;
+		std::string m_filter;
+		bool m_list = false;
+	};
+
+	class Context
+	{
+	public:
+		Context(Game& game, const Options& options);
+
+		void BeginSeededGame(uint seed);
+
+		Game& GetGame() { return m_game; }
+		THandle<ChunkMap> GetMap() { return m_game.GetMap(); }
+		THandle<Monster> GetPlayer() { return m_game.GetPlayer(); }
+
+		//Seeded location within 'radius' tiles of the player, with the chunks around it streamed in
+		Location RandomLocationNearPlayer(int radius);
+		Location RandomLocation(int radius, Location center);
+		void StreamAround(Location location, int chunkRadius = 2);
+
+		//Empties the output queue, returning the number of outputs that were waiting
+		int DrainOutputs();
+
+		const Options& GetOptions() const { return m_options; }
+		std::mt19937& GetRandom() { return m_random; }
+
+	private:
+		Game& m_game;
+		Options m_options;
+		std::mt19937 m_random;
+	};
+
+	struct Scenario
+	{
+		std::string m_name;
+		std::string m_itemName = "items";
+		int m_defaultIterations = 100;
+		std::function<void(Context&)> m_setup;
+		std::function<size_t(Context&, int)> m_run;
+		std::function<void(Context&)> m_teardown;
+	};
+
+	struct Result
+	{
+		std::string m_name;
+		std::string m_itemName;
+		int m_iterations = 0;
+		size_t m_items = 0;
+		double m_totalSeconds = 0;
+		double m_min = 0;
+		double m_mean = 0;
+		double m_p50 = 0;
+		double m_p90 = 0;
+		double m_p99 = 0;
+		double m_max = 0;
+	};
+
+	void Register(const Scenario& scenario);
+	const std::vector<Scenario>& GetScenarios();
+
+	Options ParseOptions(int argc, char* argv[]);
+	bool MatchesFilter(const std::string& name, const std::string& filter);
+
+	Result Run(Context& context, const Scenario& scenario);
+	void RunAll(Context& context);
+	void PrintResult(const Result& result);
+
+	double Percentile(std::vector<double>& sortedSamples, double percentile);
+	double SecondsSince(Clock::time_point start);
+}
+
+//Scenario groups - each lives in its own file in code/bench
+void RegisterLOSBenchmarks();
+void RegisterMapBenchmarks();
+void RegisterSaveBenchmarks();
+void RegisterViewBenchmarks();
@@ -0,0 +1,377 @@
+#include "Benchmark.h"
+#include "LOS/LOS.h"
+#include "LOS/TileMemory.h"
+#include "Map/Map.h"
+#include "Map/MapUtils.h"
+#include "Core/Monster/Monster.h"
+#include "Core/Collections/BitMask.h"
+#include "Utils/FormatUtils.h"
+#include "Data/RogueDataManager.h"
+#include "Game/ThreadManagers.h"
+
+/*
+	Line of sight scenarios. Samples are drawn up front (and streamed in) so that
+	the timed section only covers the shadowcasting itself.
+*/
+
+namespace
+{
+	static constexpr int NumSamples = 64;
+	static constexpr int SampleRadius = 40;
+	static constexpr int NumBatchMonsters = 128;
+
+	std::vector<Location> samples;
+	std::vector<THandle<Monster>> monsters;
+	View view;
+
+	//Drawn once, so every scenario casts from the same places
+	void DrawSamples(Bench::Context& context)
+	{
+		if (!samples.empty()) { return; }
+
+		for (int i = 0; i < NumSamples; i++)
+		{
+			samples.push_back(context.RandomLocationNearPlayer(SampleRadius));
+		}
+	}
+
+	//Rings a few portals around the player, pointing at each other, so casts have to resolve non-euclidean rows
+	void CreatePortals(Bench::Context& context)
+	{
+		static bool created = false;
+		if (created) { return; }
+		created = true;
+
+		Location center = context.GetPlayer()->GetLocation();
+		context.StreamAround(center, 4);
+
+		Direction directions[] = { North, East, South, West };
+		for (int i = 0; i < 4; i++)
+		{
+			Vec2 offset = VectorFromDirection(directions[i]);
+			Location open = Location(Vec4::WrapPosition(center.GetVector() + Vec4(offset.x * 6, offset.y * 6)));
+			Location exit = Location(Vec4::WrapPosition(center.GetVector() + Vec4(offset.x * 18 - offset.y * 9, offset.y * 18 + offset.x * 9)));
+			MapUtils::CreatePortal(open, directions[i], exit, directions[(i + 1) % 4]);
+		}
+	}
+
+	//Monsters are allocated once and reused by every batch scenario
+	void SpawnMonsters(Bench::Context& context)
+	{
+		if (!monsters.empty()) { return; }
+
+		for (int i = 0; i < NumBatchMonsters; i++)
+		{
+			THandle<Monster> monster = GetDataManager()->Allocate<Monster>(Resources::LoadSynchronous("MonsterDefinition", "Player"));
+			monster->SetLocation(context.RandomLocationNearPlayer(SampleRadius));
+			monster->SetRotation(North);
+			monster->GetView().SetRadius(30);
+			monsters.push_back(monster);
+		}
+	}
+
+	Bench::Scenario MakeCalculateScenario(const std::string& name, int radius)
+	{
+		Bench::Scenario scenario;
+		scenario.m_name = name;
+		scenario.m_itemName = "cells";
+		scenario.m_defaultIterations = 500;
+		scenario.m_setup = [radius](Bench::Context& context)
+		{
+			DrawSamples(context);
+			view.SetRadius(radius);
+		};
+		scenario.m_run = [](Bench::Context&, int iteration) -> size_t
+		{
+			view.Invalidate();
+			LOS::Calculate(view, samples[iteration % samples.size()], North);
+			return view.GetNumCells();
+		};
+		return scenario;
+	}
+
+	Bench::Scenario MakeParallelScenario(const std::string& name, int radius)
+	{
+		Bench::Scenario scenario;
+		scenario.m_name = name;
+		scenario.m_itemName = "cells";
+		scenario.m_defaultIterations = 200;
+		scenario.m_setup = [radius](Bench::Context& context)
+		{
+			DrawSamples(context);
+			view.SetRadius(radius);
+		};
+		scenario.m_run = [](Bench::Context&, int iteration) -> size_t
+		{
+			view.Invalidate();
+			LOS::CalculateParallel(view, samples[iteration % samples.size()], North);
+			return view.GetNumCells();
+		};
+		return scenario;
+	}
+
+	//Same casts as los.calculate, with the column bounds coming from the precomputed table or from the fraction arithmetic
+	Bench::Scenario MakeColumnsScenario(const std::string& name, int radius, bool useTables)
+	{
+		Bench::Scenario scenario;
+		scenario.m_name = name;
+		scenario.m_itemName = "cells";
+		scenario.m_defaultIterations = 500;
+		scenario.m_setup = [radius](Bench::Context& context)
+		{
+			DrawSamples(context);
+			view.SetRadius(radius);
+		};
+		scenario.m_run = [useTables](Bench::Context&, int iteration) -> size_t
+		{
+			static LOS::Context losContext;
+			losContext.m_useColumnTables = useTables;
+			view.Invalidate();
+			LOS::Calculate(losContext, view, samples[iteration % samples.size()], North);
+			return view.GetNumCells();
+		};
+		return scenario;
+	}
+
+	Bench::Scenario MakeKernelScenario(const std::string& name, int radius, LOS::Kernel kernel)
+	{
+		Bench::Scenario scenario;
+		scenario.m_name = name;
+		scenario.m_itemName = "cells";
+		scenario.m_defaultIterations = 500;
+		scenario.m_setup = [radius](Bench::Context& context)
+		{
+			DrawSamples(context);
+			CreatePortals(context);
+			view.SetRadius(radius);
+		};
+		scenario.m_run = [kernel](Bench::Context& context, int iteration) -> size_t
+		{
+			//Every other cast goes from the player, through the portals
+			Location location = (iteration % 2 == 0) ? context.GetPlayer()->GetLocation() : samples[(iteration / 2) % samples.size()];
+			view.Invalidate();
+			LOS::Calculate(LOS::GetThreadContext(), view, location, North, 255, kernel);
+			return view.GetNumCells();
+		};
+		return scenario;
+	}
+
+	size_t goldenMismatches = 0;
+
+	TileMemory memory;
+	size_t memoryChanges = 0; //Kept around so the callback can't be optimized out
+
+	const View* diffViews[2] = { nullptr, nullptr };
+	std::vector<uint64_t> diffMask;
+	size_t diffCount = 0; //Kept around so the counts can't be optimized out
+}
+
+void RegisterLOSBenchmarks()
+{
+	Bench::Register(MakeCalculateScenario("los.calculate.r10", 10));
+	Bench::Register(MakeCalculateScenario("los.calculate.r30", 30));
+	Bench::Register(MakeCalculateScenario("los.calculate.r60", 60));
+	Bench::Register(MakeParallelScenario("los.parallel.r60", 60));
+
+	for (int radius : { 10, 30, 60 })
+	{
+		Bench::Register(MakeColumnsScenario(string_format("los.columns.arithmetic.r%d", radius), radius, false));
+		Bench::Register(MakeColumnsScenario(string_format("los.columns.table.r%d", radius), radius, true));
+	}
+
+	Bench::Scenario portals;
+	portals.m_name = "los.portals.r30";
+	portals.m_itemName = "cells";
+	portals.m_defaultIterations = 500;
+	portals.m_setup = [](Bench::Context& context)
+	{
+		CreatePortals(context);
+		view.SetRadius(30);
+	};
+	portals.m_run = [](Bench::Context& context, int iteration) -> size_t
+	{
+		//Rotate the viewer each iteration, so every portal gets looked through from each side
+		view.Invalidate();
+		LOS::Calculate(view, context.GetPlayer()->GetLocation(), (Direction) ((iteration % 4) * 2));
+		return view.GetNumCells();
+	};
+	Bench::Register(portals);
+
+	Bench::Register(MakeKernelScenario("los.kernel.recursive.r30", 30, LOS::Kernel::Recursive));
+	Bench::Register(MakeKernelScenario("los.kernel.iterative.r30", 30, LOS::Kernel::Iterative));
+	Bench::Register(MakeKernelScenario("los.kernel.recursive.r60", 60, LOS::Kernel::Recursive));
+	Bench::Register(MakeKernelScenario("los.kernel.iterative.r60", 60, LOS::Kernel::Iterative));
+
+	//Golden comparison - every sample and rotation, through the portals, with both kernels and with the parallel cast.
+	//Fails the run on any difference.
+	Bench::Scenario golden;
+	golden.m_name = "los.golden";
+	golden.m_itemName = "casts";
+	golden.m_defaultIterations = 4;
+	golden.m_setup = [](Bench::Context& context)
+	{
+		DrawSamples(context);
+		CreatePortals(context);
+		goldenMismatches = 0;
+	};
+	golden.m_run = [](Bench::Context& context, int iteration) -> size_t
+	{
+		static const int radii[] = { 10, 30, 60 };
+		size_t casts = 0;
+		for (int radius : radii)
+		{
+			view.SetRadius(radius);
+			for (size_t i = 0; i <= samples.size(); i++)
+			{
+				Location location = (i == samples.size()) ? context.GetPlayer()->GetLocation() : samples[i];
+				Direction rotation = (Direction) ((iteration % 4) * 2);
+				if (!LOS::CompareKernels(view, location, rotation))
+				{
+					PRINT_ERR("LOS kernel mismatch at (%d, %d), radius %d, rotation %d", location.x(), location.y(), radius, rotation);
+					goldenMismatches++;
+				}
+				if (!LOS::CompareParallel(view, location, rotation))
+				{
+					PRINT_ERR("LOS parallel mismatch at (%d, %d), radius %d, rotation %d", location.x(), location.y(), radius, rotation);
+					goldenMismatches++;
+				}
+				casts++;
+			}
+		}
+		return casts;
+	};
+	golden.m_teardown = [](Bench::Context&)
+	{
+		if (goldenMismatches > 0)
+		{
+			PRINT_ERR("%zu LOS casts differed from the recursive or serial cast!", goldenMismatches);
+			exit(EXIT_FAILURE);
+		}
+	};
+	Bench::Register(golden);
+
+	//Bitmask queries between two casts from neighboring tiles, as a player taking a step would see
+	Bench::Scenario diff;
+	diff.m_name = "los.visibility.diff.r30";
+	diff.m_itemName = "cells";
+	diff.m_defaultIterations = 2000;
+	diff.m_setup = [](Bench::Context& context)
+	{
+		static View previous;
+		DrawSamples(context);
+		Location location = context.GetPlayer()->GetLocation();
+		view.SetRadius(30);
+		previous.SetRadius(30);
+		LOS::Calculate(previous, location, North);
+		LOS::Calculate(view, location.Traverse(East).first, North);
+		diffViews[0] = &view;
+		diffViews[1] = &previous;
+	};
+	diff.m_run = [](Bench::Context&, int) -> size_t
+	{
+		LOS::GetNewlyVisible(*diffViews[0], *diffViews[1], diffMask);
+		diffCount += BitMask::Count(diffMask);
+		LOS::GetNoLongerVisible(*diffViews[0], *diffViews[1], diffMask);
+		diffCount += BitMask::Count(diffMask);
+		LOS::GetVisibleByAny(diffViews, diffMask);
+		diffCount += BitMask::Count(diffMask);
+		return 3 * diffViews[0]->GetNumCells();
+	};
+	Bench::Register(diff);
+
+	//Memory update from a fresh cast each iteration, as the player sees every turn. Cost should follow the visible cell count.
+	//Memory drifts a chunk east each cast, like a long expedition, so pages behind it go cold.
+	Bench::Scenario memoryUpdate;
+	memoryUpdate.m_name = "los.memory.update.r30";
+	memoryUpdate.m_itemName = "visible";
+	memoryUpdate.m_defaultIterations = 500;
+	memoryUpdate.m_setup = [](Bench::Context& context)
+	{
+		DrawSamples(context);
+		view.SetRadius(30);
+		memory.Wipe();
+	};
+	memoryUpdate.m_run = [](Bench::Context& context, int iteration) -> size_t
+	{
+		view.Invalidate();
+		LOS::Calculate(view, context.GetPlayer()->GetLocation(), (Direction) ((iteration % 4) * 2));
+		memory.Move(Vec2(CHUNK_SIZE_X, 0));
+		memory.Update(view, [](const View::RevealedCell&, const DataTile&, const DataTile&, bool changed)
+			{
+				memoryChanges += changed;
+			});
+		return view.GetNumVisible();
+	};
+	memoryUpdate.m_teardown = [](Bench::Context&)
+	{
+		PRINT_ERR("Memory: %d pages (%d cold), %d palette entries, %zu bytes resident", memory.GetNumPages(), memory.GetNumColdPages(), memory.GetNumPaletteEntries(), memory.GetResidentBytes());
+	};
+	Bench::Register(memoryUpdate);
+
+	Bench::Scenario serial;
+	serial.m_name = "los.monsters.serial.r30";
+	serial.m_itemName = "monsters";
+	serial.m_defaultIterations = 20;
+	serial.m_setup = SpawnMonsters;
+	serial.m_run = [](Bench::Context&, int) -> size_t
+	{
+		for (THandle<Monster> monster : monsters)
+		{
+			monster->GetView().Invalidate();
+			LOS::Calculate(monster);
+		}
+		return monsters.size();
+	};
+	Bench::Register(serial);
+
+	Bench::Scenario batch;
+	batch.m_name = "los.monsters.batch.r30";
+	batch.m_itemName = "monsters";
+	batch.m_defaultIterations = 20;
+	batch.m_setup = SpawnMonsters;
+	batch.m_run = [](Bench::Context&, int) -> size_t
+	{
+		for (THandle<Monster> monster : monsters)
+		{
+			monster->GetView().Invalidate();
+		}
+		LOS::CalculateBatch(monsters);
+		return monsters.size();
+	};
+	Bench::Register(batch);
+
+	//The same batch while a background save holds every chunk. Workers have to read the shared chunks as they are -
+	//copying one away from the snapshot would swap the pointer under the other workers.
+	Bench::Scenario snapshotBatch;
+	snapshotBatch.m_name = "los.monsters.snapshot.r30";
+	snapshotBatch.m_itemName = "monsters";
+	snapshotBatch.m_defaultIterations = 20;
+	snapshotBatch.m_setup = SpawnMonsters;
+	snapshotBatch.m_run = [](Bench::Context& context, int) -> size_t
+	{
+		std::unique_ptr<Game::SaveSnapshot> snapshot = context.GetGame().TakeSaveSnapshot();
+		for (THandle<Monster> monster : monsters)
+		{
+			monster->GetView().Invalidate();
+		}
+		LOS::CalculateBatch(monsters);
+		return monsters.size();
+	};
+	Bench::Register(snapshotBatch);
+
+	//Nothing moves and nothing changes - every cast after the first should come straight from the cache
+	Bench::Scenario cached;
+	cached.m_name = "los.monsters.cached.r30";
+	cached.m_itemName = "monsters";
+	cached.m_defaultIterations = 20;
+	cached.m_setup = SpawnMonsters;
+	cached.m_run = [](Bench::Context&, int) -> size_t
+	{
+		for (THandle<Monster> monster : monsters)
+		{
+			LOS::Calculate(monster);
+		}
+		return monsters.size();
+	};
+	Bench::Register(cached);
+}
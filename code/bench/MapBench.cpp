@@ -0,0 +1,163 @@
+#include "Benchmark.h"
+#include "Map/Map.h"
+#include "Core/Monster/Monster.h"
+#include "Core/Pathfinding/Pathfinding.h"
+#include "Core/Collections/StackArray.h"
+#include "Utils/Utils.h"
+
+/*
+	Map scenarios - pathfinding, chunk streaming, heat simulation, and full game turns
+	(which is everything at once, as the game thread would see it).
+*/
+
+namespace
+{
+	static constexpr int NumPathSamples = 64;
+	static constexpr int PathRadius = 12;
+	static constexpr int StreamChunkRadius = 4;
+	static constexpr int StreamSpacing = 1024; //Tiles between each freshly streamed area, so nothing is already loaded
+
+	std::vector<Location> pathTargets;
+
+	size_t RunPath(Bench::Context& context, int iteration)
+	{
+		THandle<Monster> player = context.GetPlayer();
+		Location target = pathTargets[iteration % pathTargets.size()];
+
+		STACKARRAY(Location, locations, 60);
+		Pathfinding::PathfindingSettings settings;
+		settings.m_maxCost = 30;
+		settings.positionGenerator = GetMember(player, &Monster::GetAllowedMovements);
+		Pathfinding::GetPath(player->GetLocation(), target, settings, locations);
+		return locations.size();
+	}
+
+	size_t RunStream(Bench::Context& context, int)
+	{
+		//Counted separately from the iteration, since warmup reuses iteration numbers and every area has to be unique
+		static int streamed = 0;
+		streamed++;
+
+		Location center = context.GetPlayer()->GetLocation();
+		Location fresh = Location(Vec4::WrapPosition(center.GetVector() + Vec4(streamed * StreamSpacing, StreamSpacing)));
+
+		THandle<ChunkMap> map = context.GetMap();
+		map->TriggerStreamingAroundLocation(fresh, Vec4(StreamChunkRadius, StreamChunkRadius, 0, 0));
+		map->WaitForStreaming();
+
+		int width = (StreamChunkRadius * 2 + 1);
+		return width * width;
+	}
+
+	//Streams and simulates around the first tile past the seam. One chunk back wraps onto the last chunk before it -
+	//if wrapping misses it, it never loads and anything reading it waits forever, and if it isn't a whole chunk,
+	//simulating it builds locations past the edge of the world.
+	size_t RunSeam(Bench::Context& context, int)
+	{
+		Location player = context.GetPlayer()->GetLocation();
+		Location first = Location(0, player.y(), player.z(), player.w());
+		Location last = Location(LOCATION_MAX_X - 1, player.y(), player.z(), player.w());
+
+		THandle<ChunkMap> map = context.GetMap();
+		map->TriggerStreamingAroundLocation(first, Vec4(1, 1, 0, 0));
+		map->WaitForStreaming();
+
+		if (map->GetVisionGeneration(last.GetChunkPosition()) == ChunkMap::InvalidVisionGeneration)
+		{
+			PRINT_ERR("Chunk before the seam at (%u, %u) never streamed in!", last.x(), last.y());
+			return 0;
+		}
+
+		//Heat dirties the chunks on both sides, so the simulation walks every tile of the one before the seam
+		map->AddHeat(last, 1000);
+		map->Simulate(first, Vec4(1, 1, 0, 0));
+		return 9;
+	}
+
+	size_t RunSimulate(Bench::Context& context, int iteration)
+	{
+		THandle<ChunkMap> map = context.GetMap();
+		Location location = context.GetPlayer()->GetLocation();
+		if (iteration % 10 == 0)
+		{
+			map->AddHeat(location, 1000);
+		}
+
+		map->Simulate(location);
+
+		int width = (ACTIVE_CHUNK_RADIUS * 2 + 1);
+		return width * width;
+	}
+
+	size_t RunWait(Bench::Context& context, int)
+	{
+		Input input;
+		input.Set<EInputType::Wait>();
+		context.GetGame().HandleInputImmediate(input);
+		return context.DrainOutputs();
+	}
+
+	size_t RunMove(Bench::Context& context, int iteration)
+	{
+		//Pace back and forth, so the player stays in the same neighborhood
+		Direction direction = (iteration / 4) % 2 == 0 ? East : West;
+
+		Input input;
+		input.Set<EInputType::Movement>(direction);
+		context.GetGame().HandleInputImmediate(input);
+		return context.DrainOutputs();
+	}
+}
+
+void RegisterMapBenchmarks()
+{
+	Bench::Scenario path;
+	path.m_name = "path.request";
+	path.m_itemName = "steps";
+	path.m_defaultIterations = 500;
+	path.m_setup = [](Bench::Context& context)
+	{
+		pathTargets.clear();
+		for (int i = 0; i < NumPathSamples; i++)
+		{
+			pathTargets.push_back(context.RandomLocationNearPlayer(PathRadius));
+		}
+	};
+	path.m_run = RunPath;
+	Bench::Register(path);
+
+	Bench::Scenario stream;
+	stream.m_name = "map.stream";
+	stream.m_itemName = "chunks";
+	stream.m_defaultIterations = 20;
+	stream.m_run = RunStream;
+	Bench::Register(stream);
+
+	Bench::Scenario seam;
+	seam.m_name = "map.seam";
+	seam.m_itemName = "chunks";
+	seam.m_defaultIterations = 5;
+	seam.m_run = RunSeam;
+	Bench::Register(seam);
+
+	Bench::Scenario simulate;
+	simulate.m_name = "map.simulate";
+	simulate.m_itemName = "chunks";
+	simulate.m_defaultIterations = 100;
+	simulate.m_run = RunSimulate;
+	Bench::Register(simulate);
+
+	Bench::Scenario wait;
+	wait.m_name = "game.turn.wait";
+	wait.m_itemName = "outputs";
+	wait.m_defaultIterations = 100;
+	wait.m_run = RunWait;
+	Bench::Register(wait);
+
+	Bench::Scenario move;
+	move.m_name = "game.turn.move";
+	move.m_itemName = "outputs";
+	move.m_defaultIterations = 100;
+	move.m_run = RunMove;
+	Bench::Register(move);
+}
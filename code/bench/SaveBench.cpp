@@ -0,0 +1,86 @@
+#include "Benchmark.h"
+#include "Data/SaveManager.h"
+#include "Utils/FileUtils.h"
+
+/*
+	Save / load scenarios. Write and read go through Game::Save and Game::Load, so they cover
+	the full path - arenas, chunk map, player data and the stream backend.
+*/
+
+namespace
+{
+	const std::string BenchSaveName = "RogueCppBench.rsf";
+	std::unique_ptr<Game::SaveSnapshot> BenchSnapshot;
+
+	size_t GetSaveSize()
+	{
+		return std::filesystem::file_size(GetExecutableFolder() / BenchSaveName);
+	}
+
+	void RemoveSave(Bench::Context&)
+	{
+		std::filesystem::remove(GetExecutableFolder() / BenchSaveName);
+	}
+}
+
+void RegisterSaveBenchmarks()
+{
+	Bench::Scenario write;
+	write.m_name = "save.write";
+	write.m_itemName = "bytes";
+	write.m_defaultIterations = 20;
+	write.m_run = [](Bench::Context& context, int) -> size_t
+	{
+		context.GetGame().Save(BenchSaveName);
+		return GetSaveSize();
+	};
+	write.m_teardown = RemoveSave;
+	Bench::Register(write);
+
+	Bench::Scenario read;
+	read.m_name = "save.read";
+	read.m_itemName = "bytes";
+	read.m_defaultIterations = 20;
+	read.m_setup = [](Bench::Context& context)
+	{
+		context.GetGame().Save(BenchSaveName);
+	};
+	read.m_run = [](Bench::Context& context, int) -> size_t
+	{
+		context.GetGame().Load(BenchSaveName);
+		return GetSaveSize();
+	};
+	read.m_teardown = RemoveSave;
+	Bench::Register(read);
+
+	//What a background save still holds the game thread for - copying the arenas and sharing out the chunks
+	Bench::Scenario snapshot;
+	snapshot.m_name = "save.snapshot";
+	snapshot.m_itemName = "snapshots";
+	snapshot.m_defaultIterations = 20;
+	snapshot.m_run = [](Bench::Context& context, int) -> size_t
+	{
+		context.GetGame().TakeSaveSnapshot();
+		return 1;
+	};
+	Bench::Register(snapshot);
+
+	//The half that runs on a job worker - serializing a snapshot, without the disk
+	Bench::Scenario background;
+	background.m_name = "save.background";
+	background.m_itemName = "bytes";
+	background.m_defaultIterations = 20;
+	background.m_setup = [](Bench::Context& context)
+	{
+		BenchSnapshot = context.GetGame().TakeSaveSnapshot();
+	};
+	background.m_run = [](Bench::Context&, int) -> size_t
+	{
+		return Game::WriteSaveSnapshot(*BenchSnapshot).size();
+	};
+	background.m_teardown = [](Bench::Context&)
+	{
+		BenchSnapshot.reset();
+	};
+	Bench::Register(background);
+}
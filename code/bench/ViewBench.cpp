@@ -0,0 +1,150 @@
+#include "Benchmark.h"
+#include "Game/PlayerData.h"
+#include "Core/Monster/Monster.h"
+
+/*
+	View update scenarios - bytes per turn, and how long the client takes to decode them, for
+	both the raw and the delta encoding. Turns walk a small loop, so the player (and the view)
+	end up back where they started and recorded updates can be replayed in order forever.
+*/
+
+namespace
+{
+	static constexpr int LoopLength = 8;
+	const Direction Loop[LoopLength] = { East, East, North, North, West, West, South, South };
+
+	std::vector<TOutput<ViewUpdated>> recorded;
+	std::unique_ptr<PlayerData> client;
+	size_t sentBytes = 0;
+	int sentTurns = 0;
+
+	//Runs one turn and keeps the view updates it produced
+	void RunTurn(Bench::Context& context, const Input& input, std::vector<TOutput<ViewUpdated>>& updates)
+	{
+		Game& game = context.GetGame();
+		game.HandleInputImmediate(input);
+		while (game.HasNextOutput())
+		{
+			Output output = game.PopNextOutput();
+			if (output.m_type == ViewUpdated)
+			{
+				updates.push_back(std::move(output.Get<ViewUpdated>()));
+			}
+		}
+	}
+
+	void Step(Bench::Context& context, int step, std::vector<TOutput<ViewUpdated>>& updates)
+	{
+		Input input;
+		input.Set<EInputType::Movement>(Loop[step % LoopLength]);
+		RunTurn(context, input, updates);
+	}
+
+	//A fresh client, caught up with a first send and one full loop, then one more loop recorded for replay
+	void RecordLoop(Bench::Context& context, bool deltaEncoding)
+	{
+		context.GetGame().GetPlayerData().m_deltaEncoding = deltaEncoding;
+		context.GetGame().GetPlayerData().hasSent = false;
+		client = std::make_unique<PlayerData>();
+
+		Location start = context.GetPlayer()->GetLocation();
+		std::vector<TOutput<ViewUpdated>> updates;
+		Input wait;
+		wait.Set<EInputType::Wait>();
+		RunTurn(context, wait, updates);
+		for (int i = 0; i < LoopLength; i++)
+		{
+			Step(context, i, updates);
+		}
+
+		recorded.clear();
+		for (int i = 0; i < LoopLength; i++)
+		{
+			Step(context, i, recorded);
+		}
+
+		if (context.GetPlayer()->GetLocation() != start || recorded.size() != LoopLength)
+		{
+			PRINT_ERR("View bench loop didn't come back to where it started - replayed updates would be wrong!");
+			exit(EXIT_FAILURE);
+		}
+
+		for (const TOutput<ViewUpdated>& update : updates)
+		{
+			client->UpdateViewPlayer(update);
+		}
+		for (const TOutput<ViewUpdated>& update : recorded)
+		{
+			client->UpdateViewPlayer(update);
+		}
+	}
+
+	Bench::Scenario MakeBytesScenario(const std::string& name, bool deltaEncoding)
+	{
+		Bench::Scenario scenario;
+		scenario.m_name = name;
+		scenario.m_itemName = "bytes";
+		scenario.m_defaultIterations = 100;
+		scenario.m_setup = [deltaEncoding](Bench::Context& context)
+		{
+			context.GetGame().GetPlayerData().m_deltaEncoding = deltaEncoding;
+			sentBytes = 0;
+			sentTurns = 0;
+		};
+		scenario.m_run = [](Bench::Context& context, int) -> size_t
+		{
+			//Counted separately from the iteration, since warmup reuses iteration numbers and the loop has to stay in step
+			static int step = 0;
+			std::vector<TOutput<ViewUpdated>> updates;
+			Step(context, step++, updates);
+
+			size_t bytes = 0;
+			for (const TOutput<ViewUpdated>& update : updates)
+			{
+				bytes += update.m_data.size();
+			}
+			sentBytes += bytes;
+			sentTurns++;
+			return bytes;
+		};
+		scenario.m_teardown = [](Bench::Context& context)
+		{
+			PRINT_ERR("%.1f view update bytes per turn", (double) sentBytes / std::max(sentTurns, 1));
+			context.GetGame().GetPlayerData().m_deltaEncoding = true;
+		};
+		return scenario;
+	}
+
+	Bench::Scenario MakeDecodeScenario(const std::string& name, bool deltaEncoding)
+	{
+		Bench::Scenario scenario;
+		scenario.m_name = name;
+		scenario.m_itemName = "bytes";
+		scenario.m_defaultIterations = 400;
+		scenario.m_setup = [deltaEncoding](Bench::Context& context)
+		{
+			RecordLoop(context, deltaEncoding);
+		};
+		scenario.m_run = [](Bench::Context&, int) -> size_t
+		{
+			static int replayed = 0;
+			const TOutput<ViewUpdated>& update = recorded[replayed++ % LoopLength];
+			client->UpdateViewPlayer(update);
+			return update.m_data.size();
+		};
+		scenario.m_teardown = [](Bench::Context& context)
+		{
+			context.GetGame().GetPlayerData().m_deltaEncoding = true;
+			client.reset();
+		};
+		return scenario;
+	}
+}
+
+void RegisterViewBenchmarks()
+{
+	Bench::Register(MakeBytesScenario("view.bytes.raw", false));
+	Bench::Register(MakeBytesScenario("view.bytes.delta", true));
+	Bench::Register(MakeDecodeScenario("view.decode.raw", false));
+	Bench::Register(MakeDecodeScenario("view.decode.delta", true));
+}
@@ -47,6 +47,16 @@ public:
 		return begin() + m_size;
 	}
 
+	T* data()
+	{
+		return m_data.data();
+	}
+
+	const T* data() const
+	{
+		return m_data.data();
+	}
+
 	T& last()
 	{
 		ASSERT(m_size > 0);
@@ -172,11 +182,14 @@ namespace Serialization
 			Write(stream, "Size", size);
 			stream.BeginWrite("Values");
 			stream.OpenWriteScope();
-			for (size_t index = 0; index < values.size(); index++)
+			if (!WriteBulk<T>(stream, values))
 			{
-				stream.WriteSpacing();
-				Serializer<T>::SerializeObject(stream, values[index]);
-				stream.WriteListSeperator();
+				for (size_t index = 0; index < values.size(); index++)
+				{
+					stream.WriteSpacing();
+					Serializer<T>::SerializeObject(stream, values[index]);
+					stream.WriteListSeperator();
+				}
 			}
 			stream.CloseWriteScope();
 			stream.FinishWrite();
@@ -186,14 +199,21 @@ namespace Serialization
 		static void Deserialize(Stream& stream, FixedArray<T, N>& values)
 		{
 			size_t size = Read<Stream, size_t>(stream, "Size");
+			if (size > N || !stream.CheckReadLength(size, MinBitsEach<T>(stream)))
+			{
+				size = 0;
+			}
 			values.resize(size);
 			stream.BeginRead("Values");
 			stream.OpenReadScope();
-			for (size_t index = 0; index < size; index++)
+			if (!ReadBulk<T>(stream, values))
 			{
-				stream.ReadSpacing();
-				Serializer<T>::DeserializeObject(stream, values[index]);
-				stream.ReadListSeperator();
+				for (size_t index = 0; index < size; index++)
+				{
+					stream.ReadSpacing();
+					Serializer<T>::DeserializeObject(stream, values[index]);
+					stream.ReadListSeperator();
+				}
 			}
 			stream.CloseReadScope();
 			stream.FinishRead();
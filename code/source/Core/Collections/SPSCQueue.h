@@ -0,0 +1,63 @@
+#pragma once
+#include "Debug/Debug.h"
+
+#include <array>
+#include <atomic>
+
+//Bounded single producer / single consumer ring queue. Exactly one thread pushes and one thread pops, and
+//neither side ever takes a lock. Head and tail sit on their own cache lines, so the two sides only touch
+//each other's line when checking for full / empty.
+
+template<class T, size_t N>
+class SPSCQueue
+{
+	static_assert(N > 0 && (N & (N - 1)) == 0, "Capacity has to be a power of two");
+
+public:
+	//Producer side. Fails if the queue is full, in which case value is left untouched.
+	bool TryPush(T&& value)
+	{
+		size_t tail = m_tail.load(std::memory_order_relaxed);
+		if (tail - m_head.load(std::memory_order_acquire) == N)
+		{
+			return false;
+		}
+
+		m_items[tail & (N - 1)] = std::move(value);
+		m_tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	//Consumer side. Fails if the queue is empty.
+	bool TryPop(T& value)
+	{
+		size_t head = m_head.load(std::memory_order_relaxed);
+		if (head == m_tail.load(std::memory_order_acquire))
+		{
+			return false;
+		}
+
+		//Moved out, so the slot doesn't keep anything alive until it gets reused
+		value = std::move(m_items[head & (N - 1)]);
+		m_head.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	//Safe from either side, but only a snapshot - the other side may have moved on by the time it returns
+	bool Empty() const
+	{
+		return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire);
+	}
+
+	size_t Size() const
+	{
+		return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+	}
+
+	static constexpr size_t Capacity() { return N; }
+
+private:
+	alignas(64) std::atomic<size_t> m_head = 0;
+	alignas(64) std::atomic<size_t> m_tail = 0;
+	alignas(64) std::array<T, N> m_items;
+};
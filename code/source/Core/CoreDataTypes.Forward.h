@@ -21,14 +21,17 @@ static constexpr int CHUNK_SIZE_Y = 8;
 static constexpr int CHUNK_SIZE_Z = 1;
 static constexpr int CHUNK_SIZE_W = 1;
 
-static constexpr int LOCATION_MAX_X = 0x7FFFFFFF;
-static constexpr int LOCATION_MAX_Y = 0x7FFFFFFF;
-static constexpr int LOCATION_MAX_Z = 0x7FFFFFFF;
-static constexpr int LOCATION_MAX_W = 0x7FFFFFFF;
+//Positions wrap at a whole number of chunks, so every chunk - including the last one before the seam - is full
+static constexpr int LOCATION_MAX_X = (0x7FFFFFFF / CHUNK_SIZE_X) * CHUNK_SIZE_X;
+static constexpr int LOCATION_MAX_Y = (0x7FFFFFFF / CHUNK_SIZE_Y) * CHUNK_SIZE_Y;
+static constexpr int LOCATION_MAX_Z = (0x7FFFFFFF / CHUNK_SIZE_Z) * CHUNK_SIZE_Z;
+static constexpr int LOCATION_MAX_W = (0x7FFFFFFF / CHUNK_SIZE_W) * CHUNK_SIZE_W;
 
 static constexpr int CHUNK_MAX_X = LOCATION_MAX_X / CHUNK_SIZE_X;
 static constexpr int CHUNK_MAX_Y = LOCATION_MAX_Y / CHUNK_SIZE_Y;
 static constexpr int CHUNK_MAX_Z = LOCATION_MAX_Z / CHUNK_SIZE_Z;
 static constexpr int CHUNK_MAX_W = LOCATION_MAX_W / CHUNK_SIZE_W;
+static_assert(CHUNK_MAX_X * CHUNK_SIZE_X == LOCATION_MAX_X && CHUNK_MAX_Y * CHUNK_SIZE_Y == LOCATION_MAX_Y, "Chunks have to tile the world exactly");
+static_assert(CHUNK_MAX_Z * CHUNK_SIZE_Z == LOCATION_MAX_Z && CHUNK_MAX_W * CHUNK_SIZE_W == LOCATION_MAX_W, "Chunks have to tile the world exactly");
 
 static constexpr float BIG_FLOAT = 1000000000.0f;
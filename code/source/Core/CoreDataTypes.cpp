@@ -1,5 +1,6 @@
 #include "CoreDataTypes.h"
 #include "Data/RogueDataManager.h"
+#include "Data/RegisterSaveTypes.h"
 #include "Data/SaveManager.h"
 #include "Map/Map.h"
 #include "Debug/Profiling.h"
@@ -127,6 +128,12 @@ Tile& Location::GetTile() const
     return GetDataManager()->ResolveByTypeIndex<ChunkMap>(0)->GetTile(*this);
 }
 
+const Tile& Location::GetTileForRead() const
+{
+	ASSERT(GetValid());
+    return GetDataManager()->ResolveByTypeIndex<ChunkMap>(0)->GetTileForRead(*this);
+}
+
 Tile* Location::operator ->() const
 {
 	ASSERT(GetValid());
@@ -206,6 +213,8 @@ void Location::SetNeighbor(Direction direction, Location location, Direction rot
 			neighbors->NW_Direction = rotation;
 			break;
 	}
+
+	GetDataManager()->ResolveByTypeIndex<ChunkMap>(0)->MarkVisionDirty(*this);
 }
 
 std::pair<Location, Direction> Location::Traverse(Vec2 offset, Direction rotation)
@@ -289,7 +298,7 @@ std::pair<Location, Direction> Location::_Traverse_No_Neighbor(Direction directi
 {
     ROGUE_PROFILE_SECTION("LOS::_Traverse_No_Neighbor");
     ASSERT(GetValid());
-    ASSERT((!GetTile().m_stats.IsValid() || !GetTile().m_stats->m_neighbors.IsValid()));
+    ASSERT((!GetTileForRead().m_stats.IsValid() || !GetTileForRead().m_stats->m_neighbors.IsValid()));
     return std::make_pair(GetNeighbor(direction), North);
 }
 
@@ -297,8 +306,9 @@ std::pair<Location, Direction> Location::_Traverse_Neighbors(Direction direction
 {
     ROGUE_PROFILE_SECTION("LOS::_Traverse_Neighbors");
     ASSERT(GetValid());
-    ASSERT(GetTile().m_stats.IsValid());
-    THandle<TileNeighbors> neighbors = GetTile().m_stats->m_neighbors;
+    const Tile& tile = GetTileForRead();
+    ASSERT(tile.m_stats.IsValid());
+    THandle<TileNeighbors> neighbors = tile.m_stats->m_neighbors;
     ASSERT(neighbors.IsValid());
 
     Location foundTile;
@@ -349,7 +359,7 @@ std::pair<Location, Direction> Location::_Traverse_Neighbors(Direction direction
 bool Location::UsingInstanceData() const
 {
 	ASSERT(GetValid());
-    return GetTile().UsingInstanceData();
+    return GetTileForRead().UsingInstanceData();
 }
 
 void Location::CreateInstanceData() const
@@ -373,7 +383,7 @@ THandle<TileStats> Location::GetInstanceData() const
 {
 	ASSERT(UsingInstanceData());
 
-	return GetTile().m_stats;
+	return GetTileForRead().m_stats;
 }
 
 bool Location::HasNeighbors() const
@@ -411,6 +421,9 @@ void Location::CreateDefaultNeighbors() const
 	neighbors->W_Direction = North;
 	neighbors->NW_Direction = North;
 
+	//Having neighbors at all changes how LOS treats this tile
+	GetDataManager()->ResolveByTypeIndex<ChunkMap>(0)->MarkVisionDirty(*this);
+
 	ASSERT(HasNeighbors());
 }
 
@@ -487,6 +487,14 @@ inline static Direction ReverseRotation(Direction rotation)
     return (Direction)((8 - rotation) % 8);
 }
 
+//Everything LOS needs to know about a tile, read from its chunk's packed masks
+struct VisionTile
+{
+    bool m_valid = false;
+    bool m_wall = false;
+    bool m_portal = false; //Has neighbor data, which LOS has to recast through
+};
+
 class Location
 {
 public:
@@ -511,6 +519,8 @@ public:
 
 
     Tile& GetTile() const;
+    //Reads without claiming the chunk for writing - what LOS workers go through (see ChunkMap::GetTileForRead)
+    const Tile& GetTileForRead() const;
     Tile* operator ->() const;
 
     Location GetNeighbor(Direction direction);
@@ -861,4 +871,14 @@ namespace Serialization
 			}
 		}
     };
+
+    //Plain values - arrays of these are copied out whole on packed streams
+    template<> struct IsTriviallySerializable<Direction> : std::true_type {};
+    template<> struct IsTriviallySerializable<Vec2> : std::true_type {};
+    template<> struct IsTriviallySerializable<Vec3> : std::true_type {};
+    template<> struct IsTriviallySerializable<Vec4> : std::true_type {};
+    template<> struct IsTriviallySerializable<Color> : std::true_type {};
+#ifndef LINK_TILE
+    template<> struct IsTriviallySerializable<Location> : std::true_type {};
+#endif
 }
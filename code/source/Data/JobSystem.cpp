@@ -74,6 +74,11 @@ namespace Jobs
 		}
 	}
 
+	uint GetNumWorkers()
+	{
+		return numThreads;
+	}
+
 	void Poll()
 	{
 		wakeCondition.notify_one(); // wake one worker thread
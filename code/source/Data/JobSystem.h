@@ -13,8 +13,10 @@ namespace Jobs
 
 	void Initialize(uint numWorkers);
 	void Shutdown();
+	uint GetNumWorkers();
 
 	void QueueJob(const std::function<void()>& job);
 	bool IsBusy();
 	void Wait();
+	void Poll(); //Wakes a worker and yields - call this while spinning on your own jobs, so a sleeping worker can't miss them
 }
\ No newline at end of file
@@ -401,21 +401,23 @@ namespace Resources
 	   	LoadContext loadContext = { packedPath };
 		ResourceHeader header;
 
-		//Quick check - load the header
-		if (OpenReadPackFile(packedPath, header))
+		//Quick check - load the header. Packs written by a save version we can't read anymore need repacking.
+		if (!OpenReadPackFile(packedPath, header))
 		{
-			RogueSaveManager::CloseReadSaveFile();
-			if (header.m_version != resourceVersion)
-			{
-				return false;
-			}
+			return false;
+		}
+
+		RogueSaveManager::CloseReadSaveFile();
+		if (header.m_version != resourceVersion)
+		{
+			return false;
+		}
 
-			for (const ResourcePointer& ptr : header.m_dependencies)
+		for (const ResourcePointer& ptr : header.m_dependencies)
+		{
+			if (!IsPackedFileUpToDate(ptr.GetID()) || HasDependencyChangedSincePack(ptr.GetID(), ID))
 			{
-				if (!IsPackedFileUpToDate(ptr.GetID()) || HasDependencyChangedSincePack(ptr.GetID(), ID))
-				{
-					return false;
-				}
+				return false;
 			}
 		}
 
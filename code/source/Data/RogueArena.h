@@ -3,6 +3,7 @@
 #include "SaveManager.h"
 #include <malloc.h>
 #include <algorithm>
+#include <type_traits>
 
 struct ArenaHeader
 {
@@ -115,6 +116,13 @@ public:
 		GetHeader()->size = realNewSize;
 	}
 
+	//Independent copy with every object at the same offset, so handles resolve the same way in both.
+	//Generic allocations are untyped, so they're copied as raw bytes - the same way they're saved.
+	virtual RogueArena* Clone()
+	{
+		return new RogueArena(*this);
+	}
+
 	virtual void WriteInternals()
 	{
 		RogueSaveManager::WriteAsBuffer("Buffer", buffer);
@@ -157,6 +165,28 @@ public:
 		}
 	}
 
+	RogueArena* Clone() override
+	{
+		SpecializedArena<T>* clone = new SpecializedArena<T>();
+		if constexpr (std::is_trivially_copyable_v<T>)
+		{
+			clone->buffer = buffer;
+			return clone;
+		}
+
+		//Everything else owns memory of its own, so each object gets copy constructed into place
+		ArenaHeader* header = GetHeader();
+		clone->buffer = std::vector<char>(buffer.size(), '\0');
+		clone->InitializeHeader(header->size);
+		clone->GetHeader()->currentOffset = header->currentOffset;
+
+		for (int i = sizeof(ArenaHeader); i < header->currentOffset; i += sizeof(T))
+		{
+			new(clone->Get<T>(i)) T(*Get<T>(i));
+		}
+		return clone;
+	}
+
 	void WriteInternals() override
 	{
 		ArenaHeader* header = GetHeader();
@@ -184,6 +214,9 @@ public:
 			RogueSaveManager::Read("Value", *Get<T>(i));
 		}
 	}
+
+private:
+	SpecializedArena() {} //Only for Clone, which fills the buffer in itself
 };
 
 /*
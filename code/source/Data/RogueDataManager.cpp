@@ -38,3 +38,21 @@ RogueDataManager::~RogueDataManager()
 		delete(arenas[i]);
 	}
 }
+
+
+RogueDataManager* RogueDataManager::CreateSnapshot()
+{
+	ROGUE_PROFILE_SECTION("DataManager::CreateSnapshot");
+	RogueDataManager* snapshot = new RogueDataManager();
+	for (size_t i = 0; i < snapshot->arenas.size(); i++)
+	{
+		delete(snapshot->arenas[i]);
+	}
+
+	snapshot->arenas.clear();
+	for (size_t i = 0; i < arenas.size(); i++)
+	{
+		snapshot->arenas.push_back(arenas[i]->Clone());
+	}
+	return snapshot;
+}
\ No newline at end of file
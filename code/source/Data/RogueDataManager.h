@@ -188,6 +188,10 @@ public:
 		}
 	}
 
+	//Copy of every arena, with every object at the same handle. Only safe from the thread that owns this manager -
+	//the copy can then be read from anywhere, while this one carries on changing.
+	RogueDataManager* CreateSnapshot();
+
 	void LoadAll()
 	{
 		ROGUE_PROFILE_SECTION("DataManager::LoadAll");
@@ -1,6 +1,57 @@
 #include "Data/SaveManager.h"
+#include <atomic>
+#include <string>
 
 namespace RogueSaveManager
 {
 	thread_local SaveStreamType Stream::stream;
+
+	void OpenWriteSaveBuffer(size_t reserve)
+	{
+		Stream::stream = SaveStreamType();
+		std::dynamic_pointer_cast<VectorBackend>(Stream::stream.GetDataBackend())->m_data.reserve(reserve);
+		WriteHeader();
+	}
+
+	std::vector<char> CloseWriteSaveBuffer()
+	{
+		Stream::stream.AllWritesFinished();
+		std::shared_ptr<VectorBackend> backend = std::dynamic_pointer_cast<VectorBackend>(Stream::stream.GetDataBackend());
+		ASSERT(backend != nullptr);
+		std::vector<char> buffer = std::move(backend->m_data);
+		Stream::stream.Close();
+		return buffer;
+	}
+
+	bool WriteSaveBufferToPath(const std::filesystem::path path, const std::vector<char>& buffer)
+	{
+		ROGUE_PROFILE_SECTION("Write Save Buffer");
+		//Every write gets its own temporary, so two saves in flight never share a half written file
+		static std::atomic<uint> nextTemporary = 0;
+		std::filesystem::path temporary = path;
+		temporary += ".tmp" + std::to_string(nextTemporary.fetch_add(1, std::memory_order_relaxed));
+		std::error_code error;
+
+		{
+			std::ofstream file(temporary, std::ios::out | std::ios::binary);
+			file.write(buffer.data(), buffer.size());
+			file.close();
+			if (file.fail())
+			{
+				PRINT_ERR("Couldn't write save to %s", temporary.string().c_str());
+				std::filesystem::remove(temporary, error);
+				return false;
+			}
+		}
+
+		std::filesystem::rename(temporary, path, error);
+		if (error)
+		{
+			PRINT_ERR("Couldn't move save into place at %s", path.string().c_str());
+			std::filesystem::remove(temporary, error);
+			return false;
+		}
+
+		return true;
+	}
 }
\ No newline at end of file
@@ -29,7 +29,26 @@ namespace RogueSaveManager {
 		static thread_local SaveStreamType stream;
 	};
 	
-	const short version = 4;
+	//Bump whenever something saved changes layout, so older files are refused instead of misread.
+	//5 packed View cells (cells, chunk table, visibility mask), 6 paged TileMemory, 7 Z-ordered memory pages,
+	//8 palette encoded memory, 9 switched integers to varints, and 10 copies plain arrays out whole.
+	//Versions back to oldestVersion still load, read back the way they were written.
+	const short version = 10;
+	const short oldestVersion = 8;
+
+	static EStreamVersion GetStreamVersion(short fileVersion)
+	{
+		ASSERT(fileVersion >= oldestVersion && fileVersion <= version);
+		switch (fileVersion)
+		{
+		case 8:
+			return EStreamVersion::FixedWidthInts;
+		case 9:
+			return EStreamVersion::Varints;
+		default:
+			return EStreamVersion::Latest;
+		}
+	}
 	const char* const header = "RSFL";
 
 
@@ -67,15 +86,31 @@ namespace RogueSaveManager {
 		Serialization::ReadRawBytes(Stream::stream, name, values);
 	}
 
-	static void OpenWriteSaveFileByPath(const std::filesystem::path path)
+	static void WriteHeader()
 	{
-		Stream::stream = SaveStreamType(path, true);
-
+		//Header and version are always fixed width, so any reader can find out what follows
+		Stream::stream.SetVersion(EStreamVersion::FixedWidthInts);
 		Stream::stream.Write(header, 4);
 		Stream::stream.FinishWrite();
 		Write("Version", version);
+		Stream::stream.SetVersion(EStreamVersion::Latest);
 	}
 
+	static void OpenWriteSaveFileByPath(const std::filesystem::path path)
+	{
+		Stream::stream = SaveStreamType(path, true);
+		WriteHeader();
+	}
+
+	//Same as a save file, but kept in memory - for saves that get written out somewhere else, later.
+	//Reserving about what the last one took saves regrowing the buffer all the way up.
+	void OpenWriteSaveBuffer(size_t reserve = 0);
+	std::vector<char> CloseWriteSaveBuffer();
+
+	//Puts a finished save buffer on disk. Doesn't touch the save stream, so it's safe from any thread.
+	//Goes through a temporary file, so a save that fails halfway leaves the old one as it was.
+	bool WriteSaveBufferToPath(const std::filesystem::path path, const std::vector<char>& buffer);
+
 	static bool FilePathExists(const std::filesystem::path path)
 	{
 		ROGUE_PROFILE_SECTION("Check File Path");
@@ -107,6 +142,7 @@ namespace RogueSaveManager {
 		}
 
 		Stream::stream = SaveStreamType(path, false);
+		Stream::stream.SetVersion(EStreamVersion::FixedWidthInts);
 
 		{
 			ROGUE_PROFILE_SECTION("Check Header");
@@ -115,6 +151,7 @@ namespace RogueSaveManager {
 			Stream::stream.FinishRead();
 			if (strncmp(buf, header, 4) != 0)
 			{
+				Stream::stream.Close();
 				return false;
 			}
 		}
@@ -123,10 +160,13 @@ namespace RogueSaveManager {
 			ROGUE_PROFILE_SECTION("Check Version");
 			short fileVersion;
 			Read("Version", fileVersion);
-			if (fileVersion != version)
+			if (fileVersion < oldestVersion || fileVersion > version)
 			{
+				Stream::stream.Close();
 				return false;
 			}
+
+			Stream::stream.SetVersion(GetStreamVersion(fileVersion));
 		}
 
 		return true;
@@ -6,6 +6,17 @@
 #include <stdlib.h>
 #include <iostream>
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 FileBackend::FileBackend(std::filesystem::path path, bool write)
 {
 	if (write)
@@ -38,6 +49,18 @@ void FileBackend::Read(char* ptr, size_t length)
 	m_stream.read(ptr, length);
 }
 
+size_t FileBackend::ReadUpTo(char* ptr, size_t length)
+{
+	m_stream.read(ptr, length);
+	size_t read = m_stream.gcount();
+	if (read < length)
+	{
+		//Hit the end - clear the flags, so peeking still works
+		m_stream.clear();
+	}
+	return read;
+}
+
 bool FileBackend::HasNextChar()
 {
 	return m_stream.peek() != EOF;
@@ -54,6 +77,229 @@ void FileBackend::Close()
 	m_stream.close();
 }
 
+BufferedFileBackend::BufferedFileBackend(std::filesystem::path path, bool write) : FileBackend(path, write), m_write(write)
+{
+	m_buffer.resize(BufferSize);
+}
+
+BufferedFileBackend::~BufferedFileBackend()
+{
+	Close();
+}
+
+void BufferedFileBackend::Write(const char* ptr, size_t length)
+{
+	ASSERT(m_write);
+	if (m_bufferPos + length > BufferSize)
+	{
+		Flush();
+
+		//Too big to be worth buffering
+		if (length >= BufferSize)
+		{
+			m_stream.write(ptr, length);
+			return;
+		}
+	}
+
+	memcpy(m_buffer.data() + m_bufferPos, ptr, length);
+	m_bufferPos += length;
+}
+
+void BufferedFileBackend::Read(char* ptr, size_t length)
+{
+	[[maybe_unused]] size_t read = ReadUpTo(ptr, length);
+	ASSERT(read == length);
+}
+
+size_t BufferedFileBackend::ReadUpTo(char* ptr, size_t length)
+{
+	ASSERT(!m_write);
+	size_t total = 0;
+	while (total < length)
+	{
+		if (m_bufferPos == m_bufferEnd)
+		{
+			//Big reads go straight into place
+			if (length - total >= BufferSize)
+			{
+				return total + FileBackend::ReadUpTo(ptr + total, length - total);
+			}
+
+			if (!Fill())
+			{
+				break;
+			}
+		}
+
+		size_t chunk = std::min(length - total, m_bufferEnd - m_bufferPos);
+		memcpy(ptr + total, m_buffer.data() + m_bufferPos, chunk);
+		m_bufferPos += chunk;
+		total += chunk;
+	}
+
+	return total;
+}
+
+bool BufferedFileBackend::HasNextChar()
+{
+	return m_bufferPos < m_bufferEnd || Fill();
+}
+
+char BufferedFileBackend::Peek()
+{
+	ASSERT(HasNextChar());
+	return m_buffer[m_bufferPos];
+}
+
+void BufferedFileBackend::Close()
+{
+	if (m_write)
+	{
+		Flush();
+	}
+	FileBackend::Close();
+}
+
+void BufferedFileBackend::Flush()
+{
+	if (m_bufferPos > 0 && m_stream.is_open())
+	{
+		m_stream.write(m_buffer.data(), m_bufferPos);
+	}
+	m_bufferPos = 0;
+}
+
+bool BufferedFileBackend::Fill()
+{
+	m_bufferPos = 0;
+	m_bufferEnd = FileBackend::ReadUpTo(m_buffer.data(), BufferSize);
+	return m_bufferEnd > 0;
+}
+
+MmapFileBackend::~MmapFileBackend()
+{
+	Close();
+}
+
+#ifndef _WIN32
+bool MmapFileBackend::Map(std::filesystem::path path)
+{
+	ROGUE_PROFILE_SECTION("Map File");
+	ASSERT(m_mapping == nullptr);
+
+	int handle = open(path.c_str(), O_RDONLY);
+	if (handle < 0)
+	{
+		return false;
+	}
+
+	struct stat info;
+	if (fstat(handle, &info) < 0 || info.st_size == 0)
+	{
+		//Empty files can't be mapped - the buffered backend handles them fine
+		close(handle);
+		return false;
+	}
+
+	size_t size = size_t(info.st_size);
+	void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, handle, 0);
+	close(handle); //The mapping keeps the file alive on its own
+	if (mapping == MAP_FAILED)
+	{
+		return false;
+	}
+
+	//Read front to back - let the kernel read ahead aggressively
+	madvise(mapping, size, MADV_SEQUENTIAL);
+
+	m_mapping = mapping;
+	m_mappedSize = size;
+	m_data = std::span<const char>((const char*) mapping, size);
+	m_readPos = 0;
+	return true;
+}
+
+void MmapFileBackend::Close()
+{
+	if (m_mapping != nullptr)
+	{
+		munmap(m_mapping, m_mappedSize);
+		m_mapping = nullptr;
+		m_mappedSize = 0;
+	}
+	m_data = {};
+	m_readPos = 0;
+}
+#else
+bool MmapFileBackend::Map(std::filesystem::path path)
+{
+	ROGUE_PROFILE_SECTION("Map File");
+	ASSERT(m_mapping == nullptr);
+
+	HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+	{
+		//Empty files can't be mapped - the buffered backend handles them fine
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE fileMapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	CloseHandle(file);
+	if (fileMapping == nullptr)
+	{
+		return false;
+	}
+
+	void* mapping = MapViewOfFile(fileMapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(fileMapping); //The view keeps the mapping alive on its own
+	if (mapping == nullptr)
+	{
+		return false;
+	}
+
+	size_t size = size_t(fileSize.QuadPart);
+	m_mapping = mapping;
+	m_mappedSize = size;
+	m_data = std::span<const char>((const char*) mapping, size);
+	m_readPos = 0;
+	return true;
+}
+
+void MmapFileBackend::Close()
+{
+	if (m_mapping != nullptr)
+	{
+		UnmapViewOfFile(m_mapping);
+		m_mapping = nullptr;
+		m_mappedSize = 0;
+	}
+	m_data = {};
+	m_readPos = 0;
+}
+#endif
+
+std::shared_ptr<DataBackend> OpenFileBackend(std::filesystem::path path, bool write)
+{
+	if (!write)
+	{
+		std::shared_ptr<MmapFileBackend> mapped = std::make_shared<MmapFileBackend>();
+		if (mapped->Map(path))
+		{
+			return mapped;
+		}
+	}
+
+	return std::make_shared<BufferedFileBackend>(path, write);
+}
+
 void VectorBackend::Write(const char* ptr, size_t length)
 {
 	m_data.insert(m_data.end(), ptr, ptr + length);
@@ -66,6 +312,14 @@ void VectorBackend::Read(char* ptr, size_t length)
 	m_readPos += length;
 }
 
+size_t VectorBackend::ReadUpTo(char* ptr, size_t length)
+{
+	length = std::min(length, m_data.size() - m_readPos);
+	memcpy(ptr, m_data.data() + m_readPos, length);
+	m_readPos += length;
+	return length;
+}
+
 bool VectorBackend::HasNextChar()
 {
 	return m_readPos < m_data.size();
@@ -77,6 +331,37 @@ char VectorBackend::Peek()
 	return m_data[m_readPos];
 }
 
+void SpanBackend::Write(const char*, size_t)
+{
+	HALT(); //Read only!
+}
+
+void SpanBackend::Read(char* ptr, size_t length)
+{
+	ASSERT(m_readPos + length <= m_data.size());
+	memcpy(ptr, m_data.data() + m_readPos, length);
+	m_readPos += length;
+}
+
+size_t SpanBackend::ReadUpTo(char* ptr, size_t length)
+{
+	length = std::min(length, m_data.size() - m_readPos);
+	memcpy(ptr, m_data.data() + m_readPos, length);
+	m_readPos += length;
+	return length;
+}
+
+bool SpanBackend::HasNextChar()
+{
+	return m_readPos < m_data.size();
+}
+
+char SpanBackend::Peek()
+{
+	ASSERT(HasNextChar());
+	return m_data[m_readPos];
+}
+
 PackedStream::PackedStream()
 {
 	m_backend = std::make_shared<VectorBackend>();
@@ -85,113 +370,185 @@ PackedStream::PackedStream()
 PackedStream::PackedStream(std::filesystem::path path, bool write)
 {
 	ROGUE_PROFILE_SECTION("Open File Data Backend");
-	m_backend = std::make_shared<FileBackend>(path, write);
+	m_backend = OpenFileBackend(path, write);
+}
+
+PackedStream::PackedStream(std::shared_ptr<DataBackend> backend) : m_backend(backend)
+{
 }
 
 void PackedStream::AllWritesFinished()
 {
-	if (m_scratchBits > 0)
-	{
-		WriteScratchBit();
-	}
+	WriteAlign();
+	FlushBuffer();
 }
 
 void PackedStream::Close()
 {
+	//Only a writing stream has anything left to send
+	if (m_bufferEnd == 0)
+	{
+		FlushBuffer();
+	}
 	m_backend->Close();
 }
 
 void PackedStream::Write(const char* ptr, size_t length)
 {
 	ASSERT(m_backend != nullptr);
-	for (size_t i = 0; i < length; i++)
+	if (m_numBits == 0)
+	{
+		PutBytes(ptr, length);
+		return;
+	}
+
+	//Off a byte boundary - shift through the accumulator, several bytes at a time
+	while (length > 0)
 	{
-		WriteBits(ptr + i, 8);
+		size_t chunk = std::min<size_t>(length, MaxChunkBytes);
+		uint64_t word = 0;
+		memcpy(&word, ptr, chunk);
+		PushBits(word, int(chunk * 8));
+		ptr += chunk;
+		length -= chunk;
 	}
 }
 
 void PackedStream::Read(char* ptr, size_t length)
 {
 	ASSERT(m_backend != nullptr);
-	for (size_t i = 0; i < length; i++)
+	if (m_numBits == 0)
+	{
+		TakeBytes(ptr, length);
+		return;
+	}
+
+	while (length > 0)
 	{
-		ReadBits(ptr + i, 8);
+		size_t chunk = std::min<size_t>(length, MaxChunkBytes);
+		uint64_t word = 0;
+		TakeBytes((char*) &word, chunk);
+		m_bits |= word << m_numBits;
+		memcpy(ptr, &m_bits, chunk);
+		m_bits >>= chunk * 8;
+		ptr += chunk;
+		length -= chunk;
 	}
 }
 
-void PackedStream::WriteBits(const char* word, int bits)
+bool PackedStream::CheckReadLength(size_t count, size_t bitsEach)
 {
-	ASSERT(m_scratchBits < 8);
-	ASSERT(bits <= 8);
-	int wordAsInt = *word;
-	unsigned int value = (wordAsInt & 0xFF) << m_scratchBits;
-
-	unsigned int mask = (0xFF >> (8 - bits)) << m_scratchBits;
+	if (m_failed) { return false; }
 
-	m_scratch &= ~mask;
-	m_scratch |= value;
-	m_scratchBits += bits;
+	//Backends that can't tell how much is left are files we wrote ourselves
+	size_t backendBytes = m_backend->GetRemaining();
+	if (backendBytes == SIZE_MAX || bitsEach == 0) { return true; }
 
-	if (m_scratchBits >= 8)
+	size_t remainingBits = ((backendBytes + (m_bufferEnd - m_bufferPos)) * 8) + m_numBits;
+	if (count > remainingBits / bitsEach)
 	{
-		WriteScratchBit();
+		m_failed = true;
+		return false;
 	}
-}
 
-void PackedStream::WriteScratchBit()
-{
-	char end = (m_scratch & 0xFF);
-	m_backend->Write(&end, 1);
-	m_scratch = m_scratch >> 8;
-	m_scratchBits = std::max(0, m_scratchBits - 8);
+	return true;
 }
 
 void PackedStream::WriteAlign()
 {
-	const int numToWrite = (32 - m_scratchBits) % 8;
+	if (m_numBits > 0)
+	{
+		PushBits(0, 8 - m_numBits);
+		ASSERT(m_numBits == 0);
+	}
+}
 
-	if (numToWrite > 0)
+void PackedStream::ReadAlign()
+{
+	if (m_numBits > 0)
 	{
-		char zero = 0;
-		WriteBits(&zero, numToWrite);
-		ASSERT(m_scratchBits == 0);
+		//Padding we wrote is always zero - anything else means the data isn't ours
+		if (m_bits != 0)
+		{
+			m_failed = true;
+		}
+		m_bits = 0;
+		m_numBits = 0;
 	}
 }
 
-void PackedStream::ReadBits(char* ptr, int bits)
+void PackedStream::PutBytes(const char* ptr, size_t length)
 {
-	if (m_scratchBits < bits)
+	ASSERT(m_numBits == 0);
+	if (m_bufferPos + length > BufferSize)
 	{
-		ReadScratchBit();
+		FlushBuffer();
+
+		//Big runs skip the buffer entirely
+		if (length >= BufferSize)
+		{
+			m_backend->Write(ptr, length);
+			return;
+		}
 	}
 
-	*ptr = (m_scratch & (0xFF >> (8 - bits)));
-	m_scratchBits -= bits;
-	m_scratch = m_scratch >> bits;
+	memcpy(m_buffer + m_bufferPos, ptr, length);
+	m_bufferPos += length;
 }
 
-void PackedStream::ReadScratchBit()
+void PackedStream::TakeBytes(char* ptr, size_t length)
 {
-	ASSERT(m_scratchBits < 8);
-	char byte;
-	m_backend->Read(&byte, 1);
-	int shiftValue = byte;
-	m_scratch |= ((shiftValue & 0xFF) << m_scratchBits);
-	m_scratchBits += 8;
+	size_t buffered = std::min(length, m_bufferEnd - m_bufferPos);
+	memcpy(ptr, m_buffer + m_bufferPos, buffered);
+	m_bufferPos += buffered;
+	ptr += buffered;
+	length -= buffered;
+
+	if (length == 0)
+	{
+		return;
+	}
+
+	//Big runs read straight into place
+	if (length >= BufferSize)
+	{
+		size_t read = m_backend->ReadUpTo(ptr, length);
+		ptr += read;
+		length -= read;
+	}
+	else
+	{
+		FillBuffer();
+		size_t read = std::min(length, m_bufferEnd);
+		memcpy(ptr, m_buffer, read);
+		m_bufferPos = read;
+		ptr += read;
+		length -= read;
+	}
+
+	//Ran off the end of the data
+	if (length > 0)
+	{
+		memset(ptr, 0, length);
+		m_failed = true;
+	}
 }
 
-void PackedStream::ReadAlign()
+void PackedStream::FlushBuffer()
 {
-	int readBits = m_scratchBits;
-	if (readBits > 0)
+	if (m_bufferPos > 0)
 	{
-		char value;
-		ReadBits(&value, readBits);
-		ASSERT(value == 0);
-		ASSERT(m_scratchBits == 0);
+		m_backend->Write(m_buffer, m_bufferPos);
+		m_bufferPos = 0;
 	}
 }
 
+void PackedStream::FillBuffer()
+{
+	m_bufferEnd = m_backend->ReadUpTo(m_buffer, BufferSize);
+	m_bufferPos = 0;
+}
+
 JSONStream::JSONStream()
 {
 	m_backend = std::make_shared<VectorBackend>();
@@ -199,7 +556,7 @@ JSONStream::JSONStream()
 
 JSONStream::JSONStream(std::filesystem::path path, bool write)
 {
-	m_backend = std::make_shared<FileBackend>(path, write);
+	m_backend = OpenFileBackend(path, write);
 }
 
 void JSONStream::BeginWrite(const char* name)
@@ -1,11 +1,17 @@
 #pragma once
 #include <Debug/Debug.h>
 #include "magic_enum.hpp"
+#include <bit>
+#include <cstdint>
+#include <cstring>
 #include <vector>
 #include <filesystem>
 #include <fstream>
 #include <memory>
+#include <mutex>
+#include <span>
 #include <string>
+#include <type_traits>
 
 //#define UseSpacesNotTabs
 
@@ -21,9 +27,11 @@ struct DataBackend
 	virtual ~DataBackend() {}
 	virtual void Write(const char* ptr, size_t length) = 0;
 	virtual void Read(char* ptr, size_t length) = 0;
+	virtual size_t ReadUpTo(char* ptr, size_t length) = 0; //Like Read, but stops early at the end of the data. Returns how much it read.
 	virtual bool HasNextChar() = 0;
 	virtual char Peek() = 0;
 	virtual void Close() = 0;
+	virtual size_t GetRemaining() { return SIZE_MAX; } //Bytes left to read, or SIZE_MAX if the backend can't tell
 };
 
 struct FileBackend : public DataBackend
@@ -32,6 +40,7 @@ struct FileBackend : public DataBackend
 	virtual ~FileBackend();
 	void Write(const char* ptr, size_t length) override;
 	void Read(char* ptr, size_t length) override;
+	size_t ReadUpTo(char* ptr, size_t length) override;
 	bool HasNextChar() override;
 	char Peek() override;
 	void Close() override;
@@ -42,22 +51,143 @@ struct FileBackend : public DataBackend
 struct VectorBackend : public DataBackend
 {
 	VectorBackend() {}
+	VectorBackend(std::vector<char>&& data) : m_data(std::move(data)) {}
 	virtual ~VectorBackend() {}
 	void Write(const char* ptr, size_t length) override;
 	void Read(char* ptr, size_t length) override;
+	size_t ReadUpTo(char* ptr, size_t length) override;
 	bool HasNextChar() override;
 	char Peek() override;
 	void Close() override {}
+	size_t GetRemaining() override { return m_data.size() - m_readPos; }
 
 	std::vector<char> m_data;
 	int m_readPos = 0;
 };
 
+//Reads in place from memory someone else owns, without copying it. Read only - the owner has to outlive the stream.
+struct SpanBackend : public DataBackend
+{
+	SpanBackend(std::span<const char> data) : m_data(data) {}
+	virtual ~SpanBackend() {}
+	void Write(const char* ptr, size_t length) override;
+	void Read(char* ptr, size_t length) override;
+	size_t ReadUpTo(char* ptr, size_t length) override;
+	bool HasNextChar() override;
+	char Peek() override;
+	void Close() override {}
+	size_t GetRemaining() override { return m_data.size() - m_readPos; }
+
+	std::span<const char> m_data;
+	size_t m_readPos = 0;
+};
+
+//FileBackend with a big buffer in front of it, so lots of small writes (or reads) turn into a few large ones.
+//Writes only reach the file once the buffer fills, or on Close.
+struct BufferedFileBackend : public FileBackend
+{
+	BufferedFileBackend(std::filesystem::path path, bool write);
+	virtual ~BufferedFileBackend();
+	void Write(const char* ptr, size_t length) override;
+	void Read(char* ptr, size_t length) override;
+	size_t ReadUpTo(char* ptr, size_t length) override;
+	bool HasNextChar() override;
+	char Peek() override;
+	void Close() override;
+
+	static constexpr size_t BufferSize = 256 * 1024;
+
+private:
+	void Flush();
+	bool Fill();
+
+	std::vector<char> m_buffer;
+	size_t m_bufferPos = 0; //Writing - bytes waiting to go out. Reading - next byte to hand out.
+	size_t m_bufferEnd = 0; //Reading only - end of what's been read ahead
+	bool m_write;
+};
+
+//Maps the whole file into memory and reads it in place, like a SpanBackend. Read only.
+struct MmapFileBackend : public SpanBackend
+{
+	MmapFileBackend() : SpanBackend({}) {}
+	virtual ~MmapFileBackend();
+	void Close() override;
+
+	//False if the file couldn't be mapped - callers should fall back to a BufferedFileBackend
+	bool Map(std::filesystem::path path);
+
+private:
+	void* m_mapping = nullptr;
+	size_t m_mappedSize = 0;
+};
+
+//Picks the fastest backend for a file - mapped for reads where it can be, buffered otherwise
+std::shared_ptr<DataBackend> OpenFileBackend(std::filesystem::path path, bool write);
+
+//Recycles buffers, so anything that gets filled every turn stops allocating once the pool is warm.
+//Thread safe - buffers are usually filled on one thread and handed back on another.
+template<class T>
+class TBufferPool
+{
+public:
+	std::vector<T> Acquire()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_free.empty())
+		{
+			return std::vector<T>();
+		}
+
+		std::vector<T> buffer = std::move(m_free.back());
+		m_free.pop_back();
+		buffer.clear();
+		return buffer;
+	}
+
+	void Release(std::vector<T>&& buffer)
+	{
+		if (buffer.capacity() == 0) { return; }
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_free.size() < MaxFreeBuffers)
+		{
+			m_free.push_back(std::move(buffer));
+		}
+	}
+
+private:
+	static constexpr size_t MaxFreeBuffers = 16;
+
+	std::mutex m_mutex;
+	std::vector<std::vector<T>> m_free;
+};
+
+using BufferPool = TBufferPool<char>;
+
+//Which encoding integers get. Anything that outlives the process (saves, packed resources, server frames)
+//records its version, so older data is read back the way it was written.
+enum class EStreamVersion
+{
+	FixedWidthInts, //Ints are an int8 flag bit plus 1 or 4 bytes, everything else full width
+	Varints, //Every integer wider than a byte is an LEB128 varint - zigzagged first, if it's signed
+	BulkArrays, //Arrays of trivially serializable types are one aligned raw copy (see Serialization::WriteBulk)
+	Latest = BulkArrays
+};
+
+//Bits are packed lowest first, and bytes come out in order - the same layout the old byte at a time
+//writer produced. Pending bits sit in a 64 bit accumulator and leave it a whole byte at a time, into
+//a small buffer that only goes to the backend once it fills up (or on AllWritesFinished / Close).
+//Reads mirror that, reading ahead from the backend a buffer at a time. A stream either writes or
+//reads - not both.
+//Reads never run past the end of the data - a short read fills in zeros and marks the stream as failed,
+//so anything decoding data it doesn't trust should check HasFailed once it's done.
 class PackedStream
 {
 public:
 	PackedStream();
 	PackedStream(std::filesystem::path path, bool write);
+	PackedStream(std::shared_ptr<DataBackend> backend);
 
 	void BeginWrite(const char* name) {}
 	void FinishWrite() {}
@@ -79,24 +209,78 @@ public:
 	void Write(const char* ptr, size_t length);
 	void Read(char* ptr, size_t length);
 
-	void WriteBits(const char* word, int bits);
-	void WriteScratchBit();
-	void WriteAlign();
+	//Up to 8 bits at a time
+	void WriteBits(const char* word, int bits)
+	{
+		ASSERT(bits > 0 && bits <= 8);
+		PushBits(uint8_t(*word) & ((1u << bits) - 1), bits);
+	}
 
-	void ReadBits(char* ptr, int bits);
-	void ReadScratchBit();
+	void ReadBits(char* ptr, int bits)
+	{
+		ASSERT(bits > 0 && bits <= 8);
+		if (m_numBits < bits)
+		{
+			uint8_t byte;
+			TakeBytes((char*) &byte, 1);
+			m_bits |= uint64_t(byte) << m_numBits;
+			m_numBits += 8;
+		}
+
+		*ptr = char(m_bits & ((1u << bits) - 1));
+		m_bits >>= bits;
+		m_numBits -= bits;
+	}
+
+	void WriteAlign();
 	void ReadAlign();
 
+	void SetVersion(EStreamVersion version) { m_version = version; }
+	EStreamVersion GetVersion() const { return m_version; }
+	bool SupportsBulkCopy() const { return m_version >= EStreamVersion::BulkArrays; }
+
+	//Checks a count read from the data against what's left - count values of at least bitsEach bits.
+	//Fails the stream if they can't all be there, so a corrupt length never turns into a huge allocation.
+	bool CheckReadLength(size_t count, size_t bitsEach);
+	bool HasFailed() const { return m_failed; }
+
+	void WriteVarint(uint64_t value)
+	{
+		//Seven bits a byte, lowest first, with the top bit set on every byte but the last
+		while (value >= 0x80)
+		{
+			PushBits((value & 0x7F) | 0x80, 8);
+			value >>= 7;
+		}
+		PushBits(value, 8);
+	}
+
+	uint64_t ReadVarint()
+	{
+		uint64_t value = 0;
+		for (int shift = 0; shift < 64; shift += 7)
+		{
+			char byte;
+			ReadBits(&byte, 8);
+			value |= uint64_t(byte & 0x7F) << shift;
+			if ((byte & 0x80) == 0)
+			{
+				break;
+			}
+		}
+		return value;
+	}
+
 	void WriteRawBytes(const char* ptr, size_t length)
 	{
 		WriteAlign();
-		m_backend->Write(ptr, length);
+		PutBytes(ptr, length);
 	}
 
 	void ReadRawBytes(char* ptr, size_t length)
 	{
 		ReadAlign();
-		m_backend->Read(ptr, length);
+		TakeBytes(ptr, length);
 	}
 
 	template<typename E>
@@ -116,8 +300,51 @@ public:
 		return m_backend;
 	}
 
-	uint32_t m_scratch = 0;
-	int m_scratchBits = 0;
+private:
+	static_assert(std::endian::native == std::endian::little, "The accumulator is copied out as bytes, lowest first");
+
+	//Integers that get a varint - single bytes are already as small as they get
+	template<typename T>
+	static constexpr bool IsVarint = std::is_integral_v<T> && sizeof(T) > 1;
+
+	static constexpr size_t BufferSize = 1024;
+	static constexpr int MaxChunkBytes = 7; //What can always go through the accumulator in one go, with up to 7 bits already pending
+
+	//Accumulator - never holds a whole byte between calls
+	void PushBits(uint64_t value, int bits)
+	{
+		m_bits |= value << m_numBits;
+		m_numBits += bits;
+		if (m_numBits >= 8)
+		{
+			int numBytes = m_numBits >> 3;
+			memcpy(m_buffer + m_bufferPos, &m_bits, sizeof(uint64_t));
+			m_bufferPos += numBytes;
+			m_bits >>= numBytes * 8;
+			m_numBits &= 7;
+
+			if (m_bufferPos >= BufferSize)
+			{
+				FlushBuffer();
+			}
+		}
+	}
+
+	void PutBytes(const char* ptr, size_t length);
+	void TakeBytes(char* ptr, size_t length);
+	void FlushBuffer();
+	void FillBuffer();
+
+	uint64_t m_bits = 0;
+	int m_numBits = 0;
+	EStreamVersion m_version = EStreamVersion::Latest;
+	bool m_failed = false;
+
+	//Writing - bytes waiting to go out. Reading - bytes read ahead, from m_bufferPos up to m_bufferEnd.
+	//Padded so the accumulator can always be copied out whole.
+	char m_buffer[BufferSize + sizeof(uint64_t)];
+	size_t m_bufferPos = 0;
+	size_t m_bufferEnd = 0;
 
 protected:
 	std::shared_ptr<DataBackend> m_backend;
@@ -136,13 +363,33 @@ void PackedStream::ReadEnum(E& value)
 	int asInteger;
 	Read(asInteger);
 	auto enumValue = magic_enum::enum_cast<E>(asInteger);
-	ASSERT(enumValue.has_value());
+	if (!enumValue.has_value())
+	{
+		m_failed = true;
+		return;
+	}
 	value = enumValue.value();
 }
 
 template<typename T>
 void PackedStream::Write(const T& value)
 {
+	if constexpr (IsVarint<T>)
+	{
+		if (m_version >= EStreamVersion::Varints)
+		{
+			using Unsigned = std::make_unsigned_t<T>;
+			Unsigned bits = Unsigned(value);
+			if constexpr (std::is_signed_v<T>)
+			{
+				//Zigzag - small negatives stay small
+				bits = Unsigned(bits << 1) ^ Unsigned(value >> (sizeof(T) * 8 - 1));
+			}
+			WriteVarint(bits);
+			return;
+		}
+	}
+
 	char* bytePtr = (char*)&value;
 	Write(bytePtr, sizeof(T));
 }
@@ -157,6 +404,12 @@ inline void PackedStream::Write(const bool& value)
 template<>
 inline void PackedStream::Write(const int& value)
 {
+	if (m_version >= EStreamVersion::Varints)
+	{
+		WriteVarint(((unsigned int) value << 1) ^ (unsigned int) (value >> 31));
+		return;
+	}
+
 	bool fitsInInt8 = (char) (INT8_MIN <= value && value <= INT8_MAX);
 	Write(fitsInInt8);
 
@@ -184,6 +437,24 @@ inline void PackedStream::Write(const std::string& value)
 template<typename T>
 void PackedStream::Read(T& value)
 {
+	if constexpr (IsVarint<T>)
+	{
+		if (m_version >= EStreamVersion::Varints)
+		{
+			using Unsigned = std::make_unsigned_t<T>;
+			Unsigned bits = Unsigned(ReadVarint());
+			if constexpr (std::is_signed_v<T>)
+			{
+				value = T(T(bits >> 1) ^ -T(bits & 1));
+			}
+			else
+			{
+				value = T(bits);
+			}
+			return;
+		}
+	}
+
 	char* bytePtr = (char*)&value;
 	Read(bytePtr, sizeof(T));
 }
@@ -198,6 +469,12 @@ inline void PackedStream::Read(bool& value)
 template<>
 inline void PackedStream::Read(int& value)
 {
+	if (m_version >= EStreamVersion::Varints)
+	{
+		unsigned int bits = (unsigned int) ReadVarint();
+		value = int(bits >> 1) ^ -int(bits & 1);
+		return;
+	}
 
 	bool fitsInInt8;
 	Read(fitsInInt8);
@@ -219,11 +496,15 @@ template<>
 inline void PackedStream::Read(std::string& value)
 {
 	size_t size = 0;
-	char buffer[128];
 	Read(size);
-	ASSERT(size <= 100);
-	Read(buffer, size);
-	value = std::string(buffer, size);
+	if (!CheckReadLength(size, 8))
+	{
+		value.clear();
+		return;
+	}
+
+	value.resize(size);
+	Read(value.data(), size);
 }
 
 class JSONStream
@@ -284,6 +565,11 @@ public:
 	template<typename E>
 	void ReadEnum(E& value);
 
+	void SetVersion(EStreamVersion) {} //Text already spells numbers out
+	bool SupportsBulkCopy() const { return false; } //Arrays stay readable, element by element
+	bool CheckReadLength(size_t, size_t) { return true; } //Debug only - never fed untrusted data
+	bool HasFailed() const { return false; }
+
 	void Close();
 
 	std::shared_ptr<DataBackend> GetDataBackend()
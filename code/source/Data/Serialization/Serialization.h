@@ -1,7 +1,9 @@
 #pragma once
+#include <cstdint>
 #include <vector>
 #include <map>
 #include <unordered_map>
+#include <type_traits>
 
 namespace Serialization
 {	
@@ -107,6 +109,63 @@ namespace Serialization
 	template<> struct Serializer<size_t> : SimpleSerializer<size_t> {};
 	template<> struct Serializer<std::string> : SimpleSerializer<std::string> {};	
 
+	//Types whose packed form can be just their bytes. Arrays of them go out as one raw copy on streams that
+	//support it, rather than one element at a time. Opt in next to the type's Serializer - anything with
+	//pointers, handles or padding shouldn't, and neither should small integers, which are smaller as varints.
+	template<typename T>
+	struct IsTriviallySerializable : std::false_type {};
+
+	template<> struct IsTriviallySerializable<char> : std::true_type {};
+	template<> struct IsTriviallySerializable<unsigned char> : std::true_type {};
+	template<> struct IsTriviallySerializable<float> : std::true_type {};
+	template<> struct IsTriviallySerializable<double> : std::true_type {};
+	template<> struct IsTriviallySerializable<uint64_t> : std::true_type {}; //Masks and hashes - dense bits, never small
+
+	//Writes a whole array in one go, if its type and the stream allow it. False means it's up to the caller.
+	template<typename T, typename Stream, typename Container>
+	bool WriteBulk(Stream& stream, const Container& values)
+	{
+		if constexpr (IsTriviallySerializable<T>::value)
+		{
+			static_assert(std::is_trivially_copyable_v<T>, "Only plain bytes can be copied out whole");
+			if (stream.SupportsBulkCopy())
+			{
+				stream.WriteRawBytes((const char*) values.data(), values.size() * sizeof(T));
+				return true;
+			}
+		}
+		return false;
+	}
+
+	//Least bits each element of an array can take, for checking lengths read back from the data
+	template<typename T, typename Stream>
+	size_t MinBitsEach(const Stream& stream)
+	{
+		if constexpr (IsTriviallySerializable<T>::value)
+		{
+			if (stream.SupportsBulkCopy())
+			{
+				return sizeof(T) * 8;
+			}
+		}
+		return 1;
+	}
+
+	//Counterpart to WriteBulk - values should already be sized
+	template<typename T, typename Stream, typename Container>
+	bool ReadBulk(Stream& stream, Container& values)
+	{
+		if constexpr (IsTriviallySerializable<T>::value)
+		{
+			if (stream.SupportsBulkCopy())
+			{
+				stream.ReadRawBytes((char*) values.data(), values.size() * sizeof(T));
+				return true;
+			}
+		}
+		return false;
+	}
+
 	template<typename Stream, typename T>
 	void Write(Stream& stream, const char* name, const T& value)
 	{
@@ -154,6 +213,10 @@ namespace Serialization
 		stream.OpenReadScope();
 		size_t size;
 		Read(stream, "Size", size);
+		if (!stream.CheckReadLength(size, sizeof(T) * 8))
+		{
+			size = 0;
+		}
 		values.resize(size);
 		stream.BeginRead("Data");
 		stream.OpenReadScope();
@@ -175,11 +238,14 @@ namespace Serialization
 			Write(stream, "Size", size);
 			stream.BeginWrite("Values");
 			stream.OpenWriteScope();
-			for (size_t i = 0; i < size; i++)
+			if (!WriteBulk<T>(stream, values))
 			{
-				stream.WriteSpacing();
-				Serializer<T>::SerializeObject(stream, values[i]);
-				stream.WriteListSeperator();
+				for (size_t i = 0; i < size; i++)
+				{
+					stream.WriteSpacing();
+					Serializer<T>::SerializeObject(stream, values[i]);
+					stream.WriteListSeperator();
+				}
 			}
 			stream.CloseWriteScope();
 			stream.FinishWrite();
@@ -190,14 +256,21 @@ namespace Serialization
 		{
 			size_t size;
 			Read(stream, "Size", size);
+			if (!stream.CheckReadLength(size, MinBitsEach<T>(stream)))
+			{
+				size = 0;
+			}
 			values.resize(size);
 			stream.BeginRead("Values");
 			stream.OpenReadScope();
-			for (size_t i = 0; i < size; i++)
+			if (!ReadBulk<T>(stream, values))
 			{
-				stream.ReadSpacing();
-				Serializer<T>::DeserializeObject(stream, values[i]);
-				stream.ReadListSeperator();
+				for (size_t i = 0; i < size; i++)
+				{
+					stream.ReadSpacing();
+					Serializer<T>::DeserializeObject(stream, values[i]);
+					stream.ReadListSeperator();
+				}
 			}
 			stream.CloseReadScope();
 			stream.FinishRead();
@@ -233,6 +306,10 @@ namespace Serialization
 		{
 			size_t size;
 			Read(stream, "Size", size);
+			if (!stream.CheckReadLength(size, 2))
+			{
+				size = 0;
+			}
 			stream.BeginRead("Values");
 			stream.OpenReadScope();
 			for (size_t i = 0; i < size; i++)
@@ -280,6 +357,10 @@ namespace Serialization
 		{
 			size_t size;
 			Read(stream, "Size", size);
+			if (!stream.CheckReadLength(size, 2))
+			{
+				size = 0;
+			}
 			stream.BeginRead("Values");
 			stream.OpenReadScope();
 			for (size_t i = 0; i < size; i++)
@@ -11,6 +11,9 @@
 #include "Core/Pathfinding/Pathfinding.h"
 #include "Utils/Utils.h"
 
+#include <algorithm>
+#include <thread>
+
 thread_local Game* Game::game = nullptr;
 thread_local RogueDataManager* Game::dataManager = nullptr;
 thread_local MaterialManager* Game::materialManager = nullptr;
@@ -25,49 +28,254 @@ Game::Game()
 void Game::LaunchGame()
 {
 	MainLoop();
+
+	//Wake anyone waiting on outputs or on room for inputs, so they can see there won't be any more
+	m_stopped.store(true, std::memory_order_release);
+	m_outputSignal.fetch_add(1, std::memory_order_release);
+	m_outputSignal.notify_all();
+	m_inputSpace.fetch_add(1, std::memory_order_release);
+	m_inputSpace.notify_all();
 }
 
-void Game::AddInput(Input input)
+void Game::AddInput(Input&& input)
 {
+	//Queues are sized so this only waits if the game thread has fallen far behind. Read the space signal
+	//before trying, so a pop that lands in between still wakes us.
+	while (true)
 	{
-		std::lock_guard lock(inputMutex);
-		m_inputs.push_back(input);
+		uint space = m_inputSpace.load(std::memory_order_acquire);
+		if (m_inputs.TryPush(std::move(input)))
+		{
+			break;
+		}
+
+		//Nobody is left to take it
+		if (m_stopped.load(std::memory_order_acquire))
+		{
+			return;
+		}
+
+		m_inputSpace.wait(space, std::memory_order_acquire);
 	}
-	inputCv.notify_all();
+
+	WakeGameThread();
 }
 
-void Game::AddOutput(Output output)
+void Game::WakeGameThread()
 {
-	std::lock_guard lock(outputMutex);
-	m_outputs.push_back(output);
+	m_inputSignal.fetch_add(1, std::memory_order_release);
+	m_inputSignal.notify_one();
+}
+
+void Game::AddOutput(Output&& output)
+{
+	//Keep outputs in the order they happened - a view update that's being held back goes out before anything else
+	if (output.m_type != ViewUpdated)
+	{
+		m_playerData.FlushViewGame();
+	}
+
+	//Every consumer keeps popping until the game has stopped, so this always wakes up again
+	while (true)
+	{
+		uint space = m_outputSpace.load(std::memory_order_acquire);
+		if (m_outputs.TryPush(std::move(output)))
+		{
+			break;
+		}
+
+		m_outputSpace.wait(space, std::memory_order_acquire);
+	}
+
+	m_outputSignal.fetch_add(1, std::memory_order_release);
+	m_outputSignal.notify_one();
 }
 
 bool Game::HasNextOutput()
 {
-	std::lock_guard lock(outputMutex);
-	return m_outputs.size() > 0;
+	return !m_outputs.Empty();
 }
 
 Output Game::PopNextOutput()
 {
-	ASSERT(HasNextOutput());
-	std::lock_guard lock(outputMutex);
-	Output result = m_outputs[0];
-	m_outputs.erase(m_outputs.begin());
+	Output result;
+	[[maybe_unused]] bool popped = m_outputs.TryPop(result);
+	ASSERT(popped);
+	m_outputSpace.fetch_add(1, std::memory_order_release);
+	m_outputSpace.notify_one();
 	return result;
 }
 
+bool Game::WaitForOutput()
+{
+	while (true)
+	{
+		uint signal = m_outputSignal.load(std::memory_order_acquire);
+		if (HasNextOutput())
+		{
+			return true;
+		}
+
+		if (m_stopped.load(std::memory_order_acquire))
+		{
+			return HasNextOutput();
+		}
+
+		m_outputSignal.wait(signal, std::memory_order_acquire);
+	}
+}
+
 void Game::Save(std::string filename)
 {
 	ROGUE_PROFILE_SECTION("Save File");
 	RogueSaveManager::OpenWriteSaveFile(filename);
-	RogueSaveManager::Write("Seed", m_seed);
-	dataManager->SaveAll();
-	RogueSaveManager::Write("Player", m_player);
-	RogueSaveManager::Write("PlayerData", m_playerData);
+	WriteSaveData(m_seed, m_player, m_playerData);
 	RogueSaveManager::CloseWriteSaveFile();
 }
 
+void Game::WriteSaveData(uint seed, THandle<Monster> player, const PlayerData& playerData)
+{
+	RogueSaveManager::Write("Seed", seed);
+	dataManager->SaveAll();
+	RogueSaveManager::Write("Player", player);
+	RogueSaveManager::Write("PlayerData", playerData);
+}
+
+std::unique_ptr<Game::SaveSnapshot> Game::TakeSaveSnapshot()
+{
+	ROGUE_PROFILE_SECTION("Take Save Snapshot");
+	std::unique_ptr<SaveSnapshot> snapshot = std::make_unique<SaveSnapshot>();
+	snapshot->m_seed = m_seed;
+	snapshot->m_player = m_player;
+	snapshot->m_playerData = m_playerData;
+	snapshot->m_dataManager.reset(dataManager->CreateSnapshot());
+	return snapshot;
+}
+
+std::vector<char> Game::WriteSaveSnapshot(SaveSnapshot& snapshot, size_t reserve)
+{
+	ROGUE_PROFILE_SECTION("Write Save Snapshot");
+
+	//Same as the managers batch LOS hands its workers - anything that resolves a handle lands in the snapshot
+	RogueDataManager* previousManager = Game::dataManager;
+	Game::dataManager = snapshot.m_dataManager.get();
+
+	RogueSaveManager::OpenWriteSaveBuffer(reserve);
+	WriteSaveData(snapshot.m_seed, snapshot.m_player, snapshot.m_playerData);
+	std::vector<char> buffer = RogueSaveManager::CloseWriteSaveBuffer();
+
+	Game::dataManager = previousManager;
+	return buffer;
+}
+
+void Game::SaveAsync(std::string filename)
+{
+	ROGUE_PROFILE_SECTION("Save File (Async)");
+	std::unique_ptr<SaveSnapshot> snapshot = TakeSaveSnapshot();
+
+	//Anything still waiting on an earlier save to this file is out of date now - write this instead
+	for (std::shared_ptr<PendingSave>& pending : m_pendingSaves)
+	{
+		if (pending->m_fileName == filename && !pending->m_started)
+		{
+			pending->m_snapshot = std::move(snapshot);
+			return;
+		}
+	}
+
+	std::shared_ptr<PendingSave> save = std::make_shared<PendingSave>();
+	save->m_fileName = filename;
+	save->m_snapshot = std::move(snapshot);
+	m_pendingSaves.push_back(save);
+	StartWaitingSaves();
+}
+
+void Game::StartWaitingSaves()
+{
+	for (std::shared_ptr<PendingSave>& save : m_pendingSaves)
+	{
+		if (save->m_started)
+		{
+			continue;
+		}
+
+		//Two jobs writing the same file could finish in either order, so wait for the one that's running
+		bool fileBusy = std::any_of(m_pendingSaves.begin(), m_pendingSaves.end(), [&](const std::shared_ptr<PendingSave>& other)
+			{
+				return other->m_started && other->m_fileName == save->m_fileName;
+			});
+		if (fileBusy)
+		{
+			continue;
+		}
+
+		save->m_started = true;
+		m_savesInFlight.fetch_add(1, std::memory_order_relaxed);
+
+		std::shared_ptr<PendingSave> job = save;
+		std::filesystem::path path = GetExecutableFolder() / save->m_fileName;
+		size_t reserve = m_lastSaveSize + m_lastSaveSize / 8;
+		Jobs::QueueJob([this, job, path, reserve]()
+			{
+				ROGUE_PROFILE_SECTION("Background Save");
+				std::vector<char> buffer = WriteSaveSnapshot(*job->m_snapshot, reserve);
+				job->m_snapshot.reset(); //Lets go of its chunks, so the game stops copying them on write
+				job->m_size = buffer.size();
+				job->m_success = RogueSaveManager::WriteSaveBufferToPath(path, buffer);
+				job->m_finished.store(true, std::memory_order_release);
+
+				//Nudge the game thread, in case it's asleep waiting for input. Last thing that touches the game,
+				//so WaitForSaves can't let it go away underneath us.
+				WakeGameThread();
+				m_savesInFlight.fetch_sub(1, std::memory_order_release);
+			});
+	}
+}
+
+void Game::ReportFinishedSaves()
+{
+	for (auto it = m_pendingSaves.begin(); it != m_pendingSaves.end();)
+	{
+		PendingSave& save = **it;
+		if (!save.m_finished.load(std::memory_order_acquire))
+		{
+			++it;
+			continue;
+		}
+
+		if (!save.m_success)
+		{
+			PRINT_ERR("Background save to %s failed", save.m_fileName.c_str());
+		}
+		m_lastSaveSize = save.m_size;
+		CreateOutput<SaveFinished>(save.m_fileName, save.m_success);
+		it = m_pendingSaves.erase(it);
+	}
+
+	//Anything that was waiting on a save that just finished can go now
+	StartWaitingSaves();
+}
+
+void Game::WaitForSaves()
+{
+	while (!m_pendingSaves.empty() || m_savesInFlight.load(std::memory_order_acquire) > 0)
+	{
+		//Every save job bumps the input signal once it's on disk, so sleep on that. The signal is read before
+		//checking, same as the main loop, so a save that finishes in between can't be missed.
+		uint signal = m_inputSignal.load(std::memory_order_acquire);
+		ReportFinishedSaves();
+		if (!m_pendingSaves.empty())
+		{
+			m_inputSignal.wait(signal, std::memory_order_acquire);
+		}
+		else
+		{
+			//Everything's reported - the jobs are only a step away from letting go of the game
+			std::this_thread::yield();
+		}
+	}
+}
+
 void Game::Load(std::string filename)
 {
 	ROGUE_PROFILE_SECTION("Load File");
@@ -154,22 +362,68 @@ void Game::MainLoop()
 	ROGUE_PROFILE;
 	while (active)
 	{
-		//Hand over OS control of lock - keeps thread efficiently sleeping until someone wants to pass it info
+		//Only sleep when there's nothing queued. The signal is read before checking, so an input pushed
+		//in between changes it and the wait returns straight away instead of missing the wakeup.
+		uint signal = m_inputSignal.load(std::memory_order_acquire);
+		if (!HasNextInput())
+		{
+			m_inputSignal.wait(signal, std::memory_order_acquire);
+		}
+
+		//Everything queued is taken as one batch, so inputs that a later one makes pointless never run
+		m_inputBatch.clear();
+		while (HasNextInput())
 		{
-			std::unique_lock lock(inputMutex);
-			inputCv.wait(lock, [this] { return m_inputs.size() > 0; });
+			m_inputBatch.push_back(PopNextInput());
 		}
+		CoalesceInputs(m_inputBatch);
 
-		while (active && HasNextInput())
+		for (const Input& input : m_inputBatch)
 		{
+			if (!active)
+			{
+				break;
+			}
+
 			ROGUE_PROFILE_SECTION("Game loop Step");
-			HandleInput(PopNextInput());
+			HandleInput(input);
 		}
+
+		//The whole batch's view changes go out as one update
+		m_playerData.FlushViewGame();
+		ReportFinishedSaves();
 	}
 
+	//Don't leave until everything is on disk
+	WaitForSaves();
 	Cleanup();
 }
 
+void Game::HandleInputImmediate(const Input& input)
+{
+	ROGUE_PROFILE_SECTION("Game loop Step (Immediate)");
+	HandleInput(input);
+	m_playerData.FlushViewGame();
+	ReportFinishedSaves();
+}
+
+void Game::CoalesceInputs(std::vector<Input>& batch)
+{
+	//Only the newest path request matters - the client replaces its path with each one it gets back
+	bool newerPath = false;
+	for (auto it = batch.rbegin(); it != batch.rend(); ++it)
+	{
+		if (it->m_type == EInputType::RequestPath)
+		{
+			if (newerPath)
+			{
+				it->Set<EInputType::InvalidInput>();
+			}
+			newerPath = true;
+		}
+	}
+}
+
 void Game::Cleanup()
 {
 	delete Game::dataManager;
@@ -186,7 +440,7 @@ void Game::HandleInput(const Input& input)
 	case EInputType::Movement:
 	{
 		ROGUE_PROFILE_SECTION("Handle Movement Input");
-		Direction offset = input.Get<Movement>()->m_direction;
+		Direction offset = input.Get<Movement>().m_direction;
 		Location next = m_player->GetLocation().Traverse(offset, m_player->GetRotation()).first;
 
 		STACKARRAY(Location, locations, 5);
@@ -227,12 +481,12 @@ void Game::HandleInput(const Input& input)
 		if (!m_portalLocation.GetValid())
 		{
 			m_portalLocation = m_player->GetLocation();
-			m_portalDirection = Rotate(input.Get<DEBUG_ADD_PORTAL>()->m_direction, m_player->GetRotation());
+			m_portalDirection = Rotate(input.Get<DEBUG_ADD_PORTAL>().m_direction, m_player->GetRotation());
 		}
 		else
 		{
 			Location exitLocation = m_player->GetLocation();
-			Direction exitDirection = Rotate(input.Get<DEBUG_ADD_PORTAL>()->m_direction, m_player->GetRotation());
+			Direction exitDirection = Rotate(input.Get<DEBUG_ADD_PORTAL>().m_direction, m_player->GetRotation());
 
 			MapUtils::CreatePortal(m_portalLocation, m_portalDirection, exitLocation, exitDirection);
 			m_portalLocation.SetValid(false);
@@ -254,8 +508,7 @@ void Game::HandleInput(const Input& input)
 		break;
 	case EInputType::BeginSeededGame:
 	{
-		auto data = input.Get<BeginSeededGame>();
-		InitNewGame(data->seed);
+		InitNewGame(input.Get<BeginSeededGame>().seed);
 		map->TriggerStreamingAroundLocation(m_player->GetLocation());
 		//Assumably, we just enqueued a ton of jobs to get the game spun up - let that queue clear out before we start
 		map->WaitForStreaming();
@@ -271,22 +524,31 @@ void Game::HandleInput(const Input& input)
 	case EInputType::LoadSaveGame:
 	{
 		InitNewGame();
-		auto data = input.Get<LoadSaveGame>();
-		Load(data->fileName);
+		Load(input.Get<LoadSaveGame>().fileName);
 		m_playerData.UpdateViewGame(m_player->GetView());
 		CreateOutput<GameReady>();
 	}
 	break;
+	case EInputType::SaveGame:
+		SaveAsync("TestSave.rsf");
+		break;
 	case EInputType::SaveAndExit:
-		Save("TestSave.rsf");
+		SaveAsync("TestSave.rsf");
 		active = false;
 		break;
 	case EInputType::ExitGame:
 		active = false;
 		break;
+	case EInputType::ConnectClient:
+		//A new client knows nothing - mark where its outputs start, then send it everything from scratch
+		CreateOutput<ClientConnected>();
+		m_playerData.hasSent = false;
+		m_playerData.UpdateViewGame(m_player->GetView());
+		CreateOutput<GameReady>();
+		break;
 	case EInputType::RequestPath:
 		{
-			Vec4 offset = input.Get<RequestPath>()->m_localOffset;
+			Vec4 offset = input.Get<RequestPath>().m_localOffset;
 			Location playerLoc = m_player->GetLocation();
 			Location offsetLoc = Location(playerLoc.GetVector() + offset);
 
@@ -296,17 +558,17 @@ void Game::HandleInput(const Input& input)
 			settings.positionGenerator = GetMember(m_player, &Monster::GetAllowedMovements);
 			if (Pathfinding::GetPath(playerLoc, offsetLoc, settings, locations))
 			{
-				vector<Vec2> offsets;
+				vector<Vec2> offsets = TOutput<RecievePath>::GetBufferPool().Acquire();
 				for (Location location : locations)
 				{
 					Vec2 diff = location.AsVec2() - playerLoc.AsVec2();
 					offsets.push_back(diff);
 				}
-				CreateOutput<RecievePath>(offsets);
+				CreateOutput<RecievePath>(std::move(offsets));
 			}
 			else
 			{
-				CreateOutput<RecievePath>(vector<Vec2>());
+				CreateOutput<RecievePath>(TOutput<RecievePath>::GetBufferPool().Acquire());
 			}
 		}
 		break;
@@ -315,15 +577,15 @@ void Game::HandleInput(const Input& input)
 
 bool Game::HasNextInput()
 {
-	std::lock_guard lock(inputMutex);
-	return m_inputs.size() > 0;
+	return !m_inputs.Empty();
 }
 
 Input Game::PopNextInput()
 {
-	ASSERT(HasNextInput());
-	std::lock_guard lock(inputMutex);
-	Input result = m_inputs[0];
-	m_inputs.erase(m_inputs.begin());
+	Input result;
+	[[maybe_unused]] bool popped = m_inputs.TryPop(result);
+	ASSERT(popped);
+	m_inputSpace.fetch_add(1, std::memory_order_release);
+	m_inputSpace.notify_one();
 	return result;
 }
@@ -1,14 +1,16 @@
 #pragma once
 #include "GameHeaders.h"
 #include "IO.h"
+#include "GameConnection.h"
 #include "PlayerData.h"
 #include "Debug/Profiling.h"
+#include "Core/Collections/SPSCQueue.h"
 
 /*
  * Big game state! This represents a thread-specific black-box which is running the game sim
  */
 
-class Game
+class Game : public GameConnection
 {
 public:
 	Game();
@@ -23,51 +25,53 @@ public:
 	bool active = true;
 
 	void LaunchGame();
-	void AddInput(Input input);
-	void AddOutput(Output output);
+	void AddInput(Input&& input) override;
+	void AddOutput(Output&& output);
 
-	bool HasNextOutput();
-	Output PopNextOutput();
+	bool HasNextOutput() override;
+	Output PopNextOutput() override;
 
-	template <EInputType inputType, class... Args>
-	void CreateInput(Args&&... args)
-	{
-		Input input;
-		std::shared_ptr<TInput<inputType>> ptr = std::make_shared<TInput<inputType>>(std::forward<Args>(args)...);
-		input.Set(ptr);
-		AddInput(input);
-	}
-
-	template <EInputType inputType>
-	void CreateInput()
-	{
-		Input input;
-		input.Set<inputType>();
-		AddInput(input);
-	}
+	//Sleeps until there's an output to pop. False once the game has stopped and every output has been popped.
+	bool WaitForOutput();
+	bool HasStopped() const { return m_stopped.load(std::memory_order_acquire); }
 
 	template <EOutputType outputType, class... Args>
 	void CreateOutput(Args&&... args)
 	{
 		ROGUE_PROFILE_SECTION("Create Output");
 		Output output;
-		std::shared_ptr<TOutput<outputType>> ptr = std::make_shared<TOutput<outputType>>(std::forward<Args>(args)...);
-		output.Set(ptr);
-		AddOutput(output);
-	}
-
-	template <EOutputType outputType>
-	void CreateOutput()
-	{
-		Output output;
-		output.Set<outputType>();
-		AddOutput(output);
+		output.Set<outputType>(std::forward<Args>(args)...);
+		AddOutput(std::move(output));
 	}
 
 	void Save(std::string filename);
 	void Load(std::string filename);
 
+	//Everything a save writes, split off from the live game so it can be written from another thread.
+	//Chunks are shared with the live map until it writes to them - everything else is copied.
+	struct SaveSnapshot
+	{
+		uint m_seed = 0;
+		THandle<Monster> m_player;
+		PlayerData m_playerData;
+		std::unique_ptr<RogueDataManager> m_dataManager;
+	};
+
+	//Two phase save - the game thread takes a snapshot, then a job worker serializes it and writes it to disk
+	//while the game carries on. SaveFinished goes out once it's there.
+	void SaveAsync(std::string filename);
+	std::unique_ptr<SaveSnapshot> TakeSaveSnapshot();
+	//Serializes a snapshot the way Save would. Safe on any thread - handles resolve into the snapshot while it runs.
+	static std::vector<char> WriteSaveSnapshot(SaveSnapshot& snapshot, size_t reserve = 0);
+	//Blocks until every background save has finished, and its SaveFinished has gone out
+	void WaitForSaves();
+
+	//Headless control - runs an input on the calling thread, bypassing the input queue. Used by tools and benchmarks.
+	void HandleInputImmediate(const Input& input);
+
 	THandle<ChunkMap> GetMap() const { return map; }
+	THandle<Monster> GetPlayer() const { return m_player; }
+	PlayerData& GetPlayerData() { return m_playerData; }
 
 private:
 	void InitNewGame(uint seed = 0);
@@ -78,14 +82,41 @@ private:
 
 	bool HasNextInput();
 	Input PopNextInput();
+	void CoalesceInputs(std::vector<Input>& batch);
 
-	//IO Handling
-	std::mutex inputMutex;
-	std::condition_variable inputCv;
-	std::vector<Input> m_inputs;
+	void WakeGameThread();
 
-	std::mutex outputMutex;
-	std::vector<Output> m_outputs;
+	//Background saves - the job fills in the result, the game thread reports it. Saves to the same file go out
+	//one at a time, in order - a save that's still waiting its turn just takes the newer snapshot instead.
+	struct PendingSave
+	{
+		std::string m_fileName;
+		std::unique_ptr<SaveSnapshot> m_snapshot;
+		bool m_started = false; //Game thread only - a job has been queued for it
+		bool m_success = false;
+		size_t m_size = 0;
+		std::atomic<bool> m_finished = false;
+	};
+
+	static void WriteSaveData(uint seed, THandle<Monster> player, const PlayerData& playerData);
+	void StartWaitingSaves();
+	void ReportFinishedSaves();
+
+	//IO Handling - the client pushes inputs and pops outputs, the game thread does the reverse
+	static constexpr size_t InputQueueSize = 256;
+	static constexpr size_t OutputQueueSize = 256;
+
+	SPSCQueue<Input, InputQueueSize> m_inputs;
+	SPSCQueue<Output, OutputQueueSize> m_outputs;
+	std::atomic<uint> m_inputSignal = 0; //Bumped on every input, so an idle game thread can sleep on it
+	std::atomic<uint> m_outputSignal = 0; //Same for outputs, for consumers that would rather sleep than poll
+	std::atomic<uint> m_inputSpace = 0; //Bumped on every pop, so a producer facing a full queue sleeps instead of spinning
+	std::atomic<uint> m_outputSpace = 0;
+	std::atomic<bool> m_stopped = false;
+	std::vector<Input> m_inputBatch;
+	std::vector<std::shared_ptr<PendingSave>> m_pendingSaves;
+	std::atomic<uint> m_savesInFlight = 0;
+	size_t m_lastSaveSize = 0; //Game thread only - how big the last background save came out, to reserve for the next
 
 	THandle<ChunkMap> map;
 
@@ -0,0 +1,27 @@
+#pragma once
+#include "IO.h"
+
+/*
+ * What the client talks to - either a Game running on a thread in this process, or a RemoteGame
+ * that forwards everything to a game server over a socket (see IPC.h). Both sides look the same:
+ * push inputs in, pop outputs out.
+ */
+
+class GameConnection
+{
+public:
+	virtual ~GameConnection() {}
+
+	virtual void AddInput(Input&& input) = 0;
+	virtual bool HasNextOutput() = 0;
+	virtual Output PopNextOutput() = 0;
+	virtual void Disconnect() {} //Stop talking to a game that sent something we couldn't read. Local games never do.
+
+	template <EInputType inputType, class... Args>
+	void CreateInput(Args&&... args)
+	{
+		Input input;
+		input.Set<inputType>(std::forward<Args>(args)...);
+		AddInput(std::move(input));
+	}
+};
@@ -1,71 +1,127 @@
 #include "IO.h"
 
-void TInput<Movement>::Serialize(DefaultStream& stream)
+void TInput<Movement>::Serialize(PackedStream& stream) const
 {
 	Serialization::Write(stream, "Direction", m_direction);
 }
 
-void TInput<Movement>::Deserialize(DefaultStream& stream)
+void TInput<Movement>::Deserialize(PackedStream& stream)
 {
 	Serialization::Read(stream, "Direction", m_direction);
 }
 
-void TInput<RequestPath>::Serialize(DefaultStream& stream)
+void TInput<RequestPath>::Serialize(PackedStream& stream) const
 {
 	Serialization::Write(stream, "Offset", m_localOffset);
 }
 
-void TInput<RequestPath>::Deserialize(DefaultStream& stream)
+void TInput<RequestPath>::Deserialize(PackedStream& stream)
 {
 	Serialization::Read(stream, "Offset", m_localOffset);
 }
 
-void TInput<BeginSeededGame>::Serialize(DefaultStream& stream)
+void TInput<BeginSeededGame>::Serialize(PackedStream& stream) const
 {
 	Serialization::Write(stream, "Seed", seed);
 }
 
-void TInput<BeginSeededGame>::Deserialize(DefaultStream& stream)
+void TInput<BeginSeededGame>::Deserialize(PackedStream& stream)
 {
 	Serialization::Read(stream, "Seed", seed);
 }
 
-void TInput<LoadSaveGame>::Serialize(DefaultStream& stream)
+void TInput<LoadSaveGame>::Serialize(PackedStream& stream) const
 {
 	Serialization::Write(stream, "File Name", fileName);
 }
 
-void TInput<LoadSaveGame>::Deserialize(DefaultStream& stream)
+void TInput<LoadSaveGame>::Deserialize(PackedStream& stream)
 {
 	Serialization::Read(stream, "File Name", fileName);
 }
 
-void TInput<DEBUG_ADD_PORTAL>::Serialize(DefaultStream& stream)
+void TInput<ConnectClient>::Serialize(PackedStream& stream) const
+{
+	Serialization::Write(stream, "Version", m_version);
+}
+
+void TInput<ConnectClient>::Deserialize(PackedStream& stream)
+{
+	Serialization::Read(stream, "Version", m_version);
+}
+
+void TInput<DEBUG_ADD_PORTAL>::Serialize(PackedStream& stream) const
 {
 	Serialization::Write(stream, "Direction", m_direction);
 }
 
-void TInput<DEBUG_ADD_PORTAL>::Deserialize(DefaultStream& stream)
+void TInput<DEBUG_ADD_PORTAL>::Deserialize(PackedStream& stream)
 {
 	Serialization::Read(stream, "Direction", m_direction);
 }
 
-void TOutput<ViewUpdated>::Serialize(DefaultStream& stream)
+TOutput<ViewUpdated>::~TOutput()
+{
+	GetBufferPool().Release(std::move(m_data));
+}
+
+PackedStream TOutput<ViewUpdated>::CreateStream()
+{
+	return PackedStream(std::make_shared<VectorBackend>(GetBufferPool().Acquire()));
+}
+
+PackedStream TOutput<ViewUpdated>::OpenStream() const
+{
+	return PackedStream(std::make_shared<SpanBackend>(std::span<const char>(m_data)));
+}
+
+BufferPool& TOutput<ViewUpdated>::GetBufferPool()
+{
+	static BufferPool pool;
+	return pool;
+}
+
+void TOutput<ViewUpdated>::Serialize(PackedStream& stream) const
 {
 	Serialization::WriteRawBytes(stream, "data", m_data);
 }
 
-void TOutput<ViewUpdated>::Deserialize(DefaultStream& stream)
+void TOutput<ViewUpdated>::Deserialize(PackedStream& stream)
 {
+	m_data = GetBufferPool().Acquire();
 	Serialization::ReadRawBytes(stream, "data", m_data);
 }
 
-void TOutput<RecievePath>::Serialize(DefaultStream& stream)
+TOutput<RecievePath>::~TOutput()
+{
+	GetBufferPool().Release(std::move(m_offsets));
+}
+
+TBufferPool<Vec2>& TOutput<RecievePath>::GetBufferPool()
+{
+	static TBufferPool<Vec2> pool;
+	return pool;
+}
+
+void TOutput<RecievePath>::Serialize(PackedStream& stream) const
 {
 	Serialization::Write(stream, "Offsets", m_offsets);
 }
 
-void TOutput<RecievePath>::Deserialize(DefaultStream& stream)
+void TOutput<RecievePath>::Deserialize(PackedStream& stream)
 {
+	m_offsets = GetBufferPool().Acquire();
 	Serialization::Read(stream, "Offsets", m_offsets);
 }
+
+void TOutput<SaveFinished>::Serialize(PackedStream& stream) const
+{
+	Serialization::Write(stream, "File Name", m_fileName);
+	Serialization::Write(stream, "Success", m_success);
+}
+
+void TOutput<SaveFinished>::Deserialize(PackedStream& stream)
+{
+	Serialization::Read(stream, "File Name", m_fileName);
+	Serialization::Read(stream, "Success", m_success);
+}
@@ -1,11 +1,24 @@
 #pragma once
 #include "GameHeaders.h"
 #include "Data/Serialization/BitStream.h"
+#include <variant>
 
 /*
 	IO controls! Defines the structs and serialization that we will need for communicating with our game threads and servers.
+	Payloads serialize to PackedStream only - it's the wire format for server mode (see IPC.h), whatever DefaultStream is.
+
+	Messages are held inline in Input / Output as a variant of every type that carries data, so making one never
+	touches the heap. Anything variable sized (view bytes, path offsets) lives in a buffer that comes from, and goes
+	back to, a pool. Adding a new message type with data means adding it to InputData / OutputData below.
 */
 
+//True if T is one of the alternatives of the variant
+template<class T, class Variant>
+struct IsVariantMember;
+
+template<class T, class... Types>
+struct IsVariantMember<T, std::variant<Types...>> : std::bool_constant<(std::is_same_v<T, Types> || ...)> {};
+
 enum EInputType
 {
 	InvalidInput,
@@ -15,8 +28,10 @@ enum EInputType
 	BeginNewGame,
 	BeginSeededGame,
 	LoadSaveGame,
+	SaveGame, //Saves in the background and keeps playing - SaveFinished says when it's on disk
 	SaveAndExit,
 	ExitGame,
+	ConnectClient,
 
 	DEBUG_FIRE,
 	DEBUG_MAKE_STONE,
@@ -24,19 +39,13 @@ enum EInputType
 	DEBUG_ADD_PORTAL
 };
 
-class InputBase
-{
-public:
-	virtual EInputType GetType() const { return EInputType::InvalidInput; }
-	virtual void Serialize(DefaultStream& stream) {}
-	virtual void Deserialize(DefaultStream& stream) {}
-};
-
 template<EInputType inputType>
-class TInputBase : public InputBase
+class TInputBase
 {
 public:
-	EInputType GetType() const override { return inputType; }
+	EInputType GetType() const { return inputType; }
+	void Serialize(PackedStream& stream) const {}
+	void Deserialize(PackedStream& stream) {}
 	const static EInputType type = inputType;
 };
 
@@ -51,8 +60,8 @@ public:
 	TInput(Direction direction) { m_direction = direction; }
 
 
-	void Serialize(DefaultStream& stream);
-	void Deserialize(DefaultStream& stream);
+	void Serialize(PackedStream& stream) const;
+	void Deserialize(PackedStream& stream);
 
 	Direction m_direction;
 };
@@ -64,8 +73,8 @@ public:
 	TInput() { m_localOffset = Vec3(0, 0, 0); }
 	TInput(Vec3 offset) { m_localOffset = offset; }
 
-	void Serialize(DefaultStream& stream);
-	void Deserialize(DefaultStream& stream);
+	void Serialize(PackedStream& stream) const;
+	void Deserialize(PackedStream& stream);
 
 	Vec3 m_localOffset;
 };
@@ -77,8 +86,8 @@ public:
 	TInput() { seed = 0; }
 	TInput(uint seedValue) { seed = seedValue; }
 
-	void Serialize(DefaultStream& stream);
-	void Deserialize(DefaultStream& stream);
+	void Serialize(PackedStream& stream) const;
+	void Deserialize(PackedStream& stream);
 
 	uint seed;
 };
@@ -90,12 +99,26 @@ public:
 	TInput() { fileName = ""; }
 	TInput(const std::string& file) { fileName = file; }
 
-	void Serialize(DefaultStream& stream);
-	void Deserialize(DefaultStream& stream);
+	void Serialize(PackedStream& stream) const;
+	void Deserialize(PackedStream& stream);
 
 	std::string fileName = "";
 };
 
+//A client attaching to a game that's already running - sent first thing over a server connection
+template<>
+class TInput<ConnectClient> : public TInputBase<ConnectClient>
+{
+public:
+	TInput() {}
+	TInput(uint version) : m_version(version) {}
+
+	void Serialize(PackedStream& stream) const;
+	void Deserialize(PackedStream& stream);
+
+	uint m_version = 0;
+};
+
 //====================================================
 //Debug outputs
 //====================================================
@@ -106,51 +129,54 @@ public:
 	TInput() {}
 	TInput(Direction direction) : m_direction(direction) {}
 
-	void Serialize(DefaultStream& stream);
-	void Deserialize(DefaultStream& stream);
+	void Serialize(PackedStream& stream) const;
+	void Deserialize(PackedStream& stream);
 
 	Direction m_direction = North;
 };
 
+using InputData = std::variant<
+	std::monostate,
+	TInput<Movement>,
+	TInput<RequestPath>,
+	TInput<BeginSeededGame>,
+	TInput<LoadSaveGame>,
+	TInput<ConnectClient>,
+	TInput<DEBUG_ADD_PORTAL>>;
+
 struct Input
 {
 public:
-	EInputType m_type;
-	std::shared_ptr<InputBase> m_data;
+	EInputType m_type = InvalidInput;
+	InputData m_data;
 
-	void Set(EInputType type, std::shared_ptr<InputBase> data = nullptr)
+	//Types without data ignore the arguments' absence - anything that has data gets built in place
+	template <EInputType type, class... Args>
+	void Set(Args&&... args)
 	{
 		m_type = type;
-		m_data = data;
-	}
-
-	template <EInputType type>
-	void Set()
-	{
-		m_type = type;
-		m_data = nullptr;
-	}
-
-	template <typename T>
-	void Set(std::shared_ptr<T> ptr)
-	{
-		m_type = ptr->GetType();
-		m_data = ptr;
+		if constexpr (IsVariantMember<TInput<type>, InputData>::value)
+		{
+			m_data.emplace<TInput<type>>(std::forward<Args>(args)...);
+		}
+		else
+		{
+			static_assert(sizeof...(Args) == 0, "Input type has no data - add it to InputData");
+			m_data.emplace<std::monostate>();
+		}
 	}
 
 	bool HasData() const
 	{
-		return m_data != nullptr;
+		return !std::holds_alternative<std::monostate>(m_data);
 	}
 
 	template <EInputType type>
-	std::shared_ptr<TInput<type>> Get() const
+	const TInput<type>& Get() const
 	{
 		ASSERT(HasData());
 		ASSERT(type == m_type);
-
-		std::shared_ptr<TInput<type>> ptr = std::static_pointer_cast<TInput<type>>(m_data);
-		return ptr;
+		return *std::get_if<TInput<type>>(&m_data);
 	}
 };
 
@@ -159,22 +185,18 @@ enum EOutputType
 	InvalidOutput,
 	GameReady,
 	ViewUpdated,
-	RecievePath
-};
-
-class OutputBase
-{
-public:
-	virtual EOutputType GetType() const { return EOutputType::InvalidOutput; }
-	virtual void Serialize(DefaultStream& stream) {}
-	virtual void Deserialize(DefaultStream& stream) {}
+	RecievePath,
+	ClientConnected, //Marks where a newly connected client's outputs start
+	SaveFinished
 };
 
 template<EOutputType outputType>
-class TOutputBase : public OutputBase
+class TOutputBase
 {
 public:
-	EOutputType GetType() const override { return outputType; }
+	EOutputType GetType() const { return outputType; }
+	void Serialize(PackedStream& stream) const {}
+	void Deserialize(PackedStream& stream) {}
 	const static EOutputType type = outputType;
 };
 
@@ -186,16 +208,30 @@ class TOutput<ViewUpdated> : public TOutputBase<ViewUpdated>
 {
 public:
 	TOutput() {}
-	TOutput(PackedStream stream)
+
+	//Takes the finished stream's buffer as is - it should have come from GetBufferPool(), and goes back there when this output dies
+	TOutput(PackedStream&& stream)
 	{
-		m_data.clear();
 		std::shared_ptr<VectorBackend> backend = dynamic_pointer_cast<VectorBackend>(stream.GetDataBackend());
 		ASSERT(backend != nullptr);
-		m_data.insert(m_data.end(), backend->m_data.begin(), backend->m_data.end());
+		m_data = std::move(backend->m_data);
 	}
 
-	void Serialize(DefaultStream& stream);
-	void Deserialize(DefaultStream& stream);
+	//Move only - the buffer belongs to whoever holds the output
+	TOutput(TOutput&& other) = default;
+	TOutput& operator=(TOutput&& other) = default;
+	~TOutput();
+
+	void Serialize(PackedStream& stream) const;
+	void Deserialize(PackedStream& stream);
+
+	//A stream for the game side to write into, backed by a recycled buffer
+	static PackedStream CreateStream();
+
+	//Reads the payload in place
+	PackedStream OpenStream() const;
+
+	static BufferPool& GetBufferPool();
 
 	std::vector<char> m_data;
 };
@@ -205,129 +241,168 @@ class TOutput<RecievePath> : public TOutputBase<RecievePath>
 {
 public:
 	TOutput() {}
-	TOutput(const vector<Vec2>& offsets) : m_offsets(offsets) {}
+	//Offsets should have come from GetBufferPool()
+	TOutput(vector<Vec2>&& offsets) : m_offsets(std::move(offsets)) {}
+
+	TOutput(TOutput&& other) = default;
+	TOutput& operator=(TOutput&& other) = default;
+	~TOutput();
 
-	void Serialize(DefaultStream& stream);
-	void Deserialize(DefaultStream& stream);
+	void Serialize(PackedStream& stream) const;
+	void Deserialize(PackedStream& stream);
+
+	static TBufferPool<Vec2>& GetBufferPool();
 
 	vector<Vec2> m_offsets;
 };
 
-struct Output
+//A background save made it to disk (or didn't)
+template <>
+class TOutput<SaveFinished> : public TOutputBase<SaveFinished>
 {
 public:
-	EOutputType m_type;
-	std::shared_ptr<OutputBase> m_data;
+	TOutput() {}
+	TOutput(const std::string& file, bool success) : m_fileName(file), m_success(success) {}
 
-	void Set(EOutputType type, std::shared_ptr<OutputBase> data = nullptr)
-	{
-		m_type = type;
-		m_data = data;
-	}
+	void Serialize(PackedStream& stream) const;
+	void Deserialize(PackedStream& stream);
 
-	template <EOutputType type>
-	void Set()
+	std::string m_fileName;
+	bool m_success = false;
+};
+
+using OutputData = std::variant<
+	std::monostate,
+	TOutput<ViewUpdated>,
+	TOutput<RecievePath>,
+	TOutput<SaveFinished>>;
+
+//Move only, since the payloads own pooled buffers
+struct Output
+{
+public:
+	EOutputType m_type = InvalidOutput;
+	OutputData m_data;
+
+	template <EOutputType type, class... Args>
+	void Set(Args&&... args)
 	{
 		m_type = type;
-		m_data = nullptr;
+		if constexpr (IsVariantMember<TOutput<type>, OutputData>::value)
+		{
+			m_data.emplace<TOutput<type>>(std::forward<Args>(args)...);
+		}
+		else
+		{
+			static_assert(sizeof...(Args) == 0, "Output type has no data - add it to OutputData");
+			m_data.emplace<std::monostate>();
+		}
 	}
 
-	template <typename T>
-	void Set(std::shared_ptr<T> ptr)
+	bool HasData() const
 	{
-		m_type = ptr->GetType();
-		m_data = ptr;
+		return !std::holds_alternative<std::monostate>(m_data);
 	}
 
-	bool HasData() const
+	template <EOutputType type>
+	const TOutput<type>& Get() const
 	{
-		return m_data != nullptr;
+		ASSERT(HasData());
+		ASSERT(type == m_type);
+		return *std::get_if<TOutput<type>>(&m_data);
 	}
 
 	template <EOutputType type>
-	std::shared_ptr<TOutput<type>> Get() const
+	TOutput<type>& Get()
 	{
 		ASSERT(HasData());
 		ASSERT(type == m_type);
-
-		std::shared_ptr<TOutput<type>> ptr = std::static_pointer_cast<TOutput<type>>(m_data);
-		return ptr;
+		return *std::get_if<TOutput<type>>(&m_data);
 	}
 };
 
-namespace Serialization
+//Builds whichever alternative carries the given message type, or nothing if that type has no data
+template<class Variant, class Type, size_t Index = 1>
+void EmplaceByType(Variant& data, Type type)
 {
-	/*
-	template<typename Stream>
-	void Serialize(Stream& stream, const Input& value)
+	if constexpr (Index < std::variant_size_v<Variant>)
 	{
-		Write(stream, "Type", value.m_type);
-		bool hasData = value.HasData();
-		Write(stream, "Has Data", hasData);
-		if (hasData)
+		if (std::variant_alternative_t<Index, Variant>::type == type)
 		{
-			stream.WriteSpacing();
-			value.Get<InputBase>()->Serialize(stream);
+			data.template emplace<Index>();
+			return;
 		}
+		EmplaceByType<Variant, Type, Index + 1>(data, type);
+	}
+	else
+	{
+		data.template emplace<std::monostate>();
 	}
+}
 
-	template<typename Stream>
-	void Deserialize(Stream& stream, Input& value)
+namespace Serialization
+{
+	template<>
+	struct Serializer<EInputType> : EnumSerializer<EInputType> {};
+
+	template<>
+	struct Serializer<EOutputType> : EnumSerializer<EOutputType> {};
+
+	template<>
+	struct Serializer<Input> : ObjectSerializer<Input>
 	{
-		Read(stream, "Type", value.m_type);
-		bool hasData;
-		Read(stream, "Has Data", hasData);
-		if (hasData)
+		static void Serialize(PackedStream& stream, const Input& value)
 		{
-			switch (value.m_type)
-			{
-			default:
-				HALT(); //Bad type! Whatever value this is needs a corresponding case in the switch.
-			case EInputType::Movement:
-				value.m_data = std::make_shared<MoveInput>();
-				break;
-			case EInputType::BeginSeededGame:
-				value.m_data = std::make_shared<BeginSeededGameInput>();
-				break;
-			case EInputType::LoadSaveGame:
-				value.m_data = std::make_shared<LoadSaveInput>();
-				break;
-			}
-
-			stream.ReadSpacing();
-			value.Get<InputBase>()->Deserialize(stream);
+			Write(stream, "Type", value.m_type);
+			std::visit([&](const auto& data)
+				{
+					if constexpr (!std::is_same_v<std::decay_t<decltype(data)>, std::monostate>)
+					{
+						data.Serialize(stream);
+					}
+				}, value.m_data);
 		}
-	}
 
-	template<typename Stream>
-	void Serialize(Stream& stream, const Output& value)
-	{
-		Write(stream, "Type", value.m_type);
-		bool hasData = value.HasData();
-		Write(stream "Has Data", hasData);
-		if (hasData)
+		static void Deserialize(PackedStream& stream, Input& value)
 		{
-			stream.WriteSpacing();
-			value.Get<OutputBase>()->Serialize(stream);
+			Read(stream, "Type", value.m_type);
+			EmplaceByType(value.m_data, value.m_type);
+			std::visit([&](auto& data)
+				{
+					if constexpr (!std::is_same_v<std::decay_t<decltype(data)>, std::monostate>)
+					{
+						data.Deserialize(stream);
+					}
+				}, value.m_data);
 		}
-	}
+	};
 
-	template<typename Stream>
-	void Deserialize(Stream& stream, Output& value)
+	template<>
+	struct Serializer<Output> : ObjectSerializer<Output>
 	{
-		Read(stream, "Type", value.m_type);
-		bool hasData;
-		Read(stream, "Has Data", hasData);
-		if (hasData)
+		static void Serialize(PackedStream& stream, const Output& value)
+		{
+			Write(stream, "Type", value.m_type);
+			std::visit([&](const auto& data)
+				{
+					if constexpr (!std::is_same_v<std::decay_t<decltype(data)>, std::monostate>)
+					{
+						data.Serialize(stream);
+					}
+				}, value.m_data);
+		}
+
+		static void Deserialize(PackedStream& stream, Output& value)
 		{
-			switch (value.m_type)
-			{
-			default:
-				HALT(); //Bad type! Whatever value this is needs a corresponding case in the switch.
-			}
-
-			stream.ReadSpacing();
-			value.Get<OutputBase>()->Deserialize(stream);
+			Read(stream, "Type", value.m_type);
+			EmplaceByType(value.m_data, value.m_type);
+			std::visit([&](auto& data)
+				{
+					if constexpr (!std::is_same_v<std::decay_t<decltype(data)>, std::monostate>)
+					{
+						data.Deserialize(stream);
+					}
+				}, value.m_data);
 		}
-	}*/
+	};
 }
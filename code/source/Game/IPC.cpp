@@ -0,0 +1,489 @@
+#include "IPC.h"
+#include "Game.h"
+#include "Data/SaveManager.h"
+#include "Data/Serialization/Serialization.h"
+#include <filesystem>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace IPC
+{
+	namespace
+	{
+		constexpr size_t HeaderSize = 4;
+
+		BufferPool& GetFramePool()
+		{
+			static BufferPool pool;
+			return pool;
+		}
+
+		template<typename T>
+		std::vector<char> Encode(const T& value)
+		{
+			//Header goes in first as a placeholder, and is filled in once the payload size is known
+			std::vector<char> buffer = GetFramePool().Acquire();
+			buffer.resize(HeaderSize);
+
+			std::shared_ptr<VectorBackend> backend = std::make_shared<VectorBackend>(std::move(buffer));
+			PackedStream stream(backend);
+			Serialization::Write(stream, "Message", value);
+			stream.AllWritesFinished();
+
+			std::vector<char> frame = std::move(backend->m_data);
+			uint length = uint(frame.size() - HeaderSize);
+			for (size_t i = 0; i < HeaderSize; i++)
+			{
+				frame[i] = char((length >> (8 * i)) & 0xFF);
+			}
+			return frame;
+		}
+
+		template<typename T>
+		bool Decode(std::span<const char> frame, T& value)
+		{
+			if (frame.empty())
+			{
+				return false;
+			}
+
+			PackedStream stream(std::make_shared<SpanBackend>(frame));
+			Serialization::Read(stream, "Message", value);
+			return !stream.HasFailed();
+		}
+	}
+
+	std::vector<char> EncodeInput(const Input& input)
+	{
+		return Encode(input);
+	}
+
+	std::vector<char> EncodeOutput(const Output& output)
+	{
+		return Encode(output);
+	}
+
+	bool DecodeInput(std::span<const char> frame, Input& input)
+	{
+		return Decode(frame, input);
+	}
+
+	bool DecodeOutput(std::span<const char> frame, Output& output)
+	{
+		return Decode(frame, output);
+	}
+
+	void ReleaseFrame(std::vector<char>&& frame)
+	{
+		GetFramePool().Release(std::move(frame));
+	}
+
+#ifndef _WIN32
+	Socket::~Socket()
+	{
+		if (m_handle >= 0)
+		{
+			close(m_handle);
+		}
+	}
+
+	std::unique_ptr<Socket> Socket::Listen(const std::string& path)
+	{
+		sockaddr_un address = {};
+		address.sun_family = AF_UNIX;
+		if (path.size() >= sizeof(address.sun_path))
+		{
+			PRINT_ERR("Socket path is too long: %s", path.c_str());
+			return nullptr;
+		}
+		strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+		int handle = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (handle < 0)
+		{
+			PRINT_ERR("Couldn't create socket");
+			return nullptr;
+		}
+
+		//Clear out whatever a previous server left behind
+		unlink(path.c_str());
+		if (bind(handle, (sockaddr*) &address, sizeof(address)) < 0 || listen(handle, 1) < 0)
+		{
+			PRINT_ERR("Couldn't listen on %s", path.c_str());
+			close(handle);
+			return nullptr;
+		}
+
+		//Only our own user gets to drive the game
+		chmod(path.c_str(), S_IRUSR | S_IWUSR);
+
+		return std::make_unique<Socket>(handle);
+	}
+
+	std::unique_ptr<Socket> Socket::Connect(const std::string& path)
+	{
+		sockaddr_un address = {};
+		address.sun_family = AF_UNIX;
+		if (path.size() >= sizeof(address.sun_path))
+		{
+			PRINT_ERR("Socket path is too long: %s", path.c_str());
+			return nullptr;
+		}
+		strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+		int handle = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (handle < 0)
+		{
+			PRINT_ERR("Couldn't create socket");
+			return nullptr;
+		}
+
+		if (connect(handle, (sockaddr*) &address, sizeof(address)) < 0)
+		{
+			PRINT_ERR("Couldn't connect to %s", path.c_str());
+			close(handle);
+			return nullptr;
+		}
+
+		return std::make_unique<Socket>(handle);
+	}
+
+	std::unique_ptr<Socket> Socket::Accept()
+	{
+		int handle = accept(m_handle, nullptr, nullptr);
+		if (handle < 0)
+		{
+			return nullptr;
+		}
+
+		return std::make_unique<Socket>(handle);
+	}
+
+	void Socket::Shutdown()
+	{
+		shutdown(m_handle, SHUT_RDWR);
+	}
+
+	bool Socket::SendAll(const char* data, size_t length)
+	{
+		while (length > 0)
+		{
+			//No SIGPIPE if the other side went away - that just shows up as a failed send
+			ssize_t sent = send(m_handle, data, length, MSG_NOSIGNAL);
+			if (sent <= 0)
+			{
+				return false;
+			}
+
+			data += sent;
+			length -= sent;
+		}
+
+		return true;
+	}
+
+	bool Socket::ReceiveAll(char* data, size_t length)
+	{
+		while (length > 0)
+		{
+			ssize_t received = recv(m_handle, data, length, 0);
+			if (received <= 0)
+			{
+				return false;
+			}
+
+			data += received;
+			length -= received;
+		}
+
+		return true;
+	}
+#else
+	//Windows would need winsock and afunix.h - not hooked up yet, so server mode just fails to start
+	Socket::~Socket() {}
+
+	std::unique_ptr<Socket> Socket::Listen(const std::string& path)
+	{
+		PRINT_ERR("Server mode isn't supported on this platform");
+		return nullptr;
+	}
+
+	std::unique_ptr<Socket> Socket::Connect(const std::string& path)
+	{
+		PRINT_ERR("Server mode isn't supported on this platform");
+		return nullptr;
+	}
+
+	std::unique_ptr<Socket> Socket::Accept() { return nullptr; }
+	void Socket::Shutdown() {}
+	bool Socket::SendAll(const char* data, size_t length) { return false; }
+	bool Socket::ReceiveAll(char* data, size_t length) { return false; }
+#endif
+
+	bool Socket::SendFrame(std::span<const char> frame)
+	{
+		ASSERT(frame.size() >= HeaderSize);
+		return SendAll(frame.data(), frame.size());
+	}
+
+	bool Socket::ReceiveFrame(std::vector<char>& frame)
+	{
+		unsigned char header[HeaderSize];
+		if (!ReceiveAll((char*) header, HeaderSize))
+		{
+			return false;
+		}
+
+		uint length = 0;
+		for (size_t i = 0; i < HeaderSize; i++)
+		{
+			length |= uint(header[i]) << (8 * i);
+		}
+
+		if (length > MaxFrameSize)
+		{
+			PRINT_ERR("Frame of %u bytes is too big - dropping the connection", length);
+			return false;
+		}
+
+		frame.resize(length);
+		return ReceiveAll(frame.data(), length);
+	}
+
+	bool GameServer::Run(const std::string& saveFile, uint seed)
+	{
+		m_listener = Socket::Listen(m_path);
+		if (!m_listener)
+		{
+			return false;
+		}
+
+		Game game;
+		std::thread gameThread(&Game::LaunchGame, &game);
+		if (RogueSaveManager::FileExists(saveFile))
+		{
+			game.CreateInput<LoadSaveGame>(saveFile);
+		}
+		else
+		{
+			game.CreateInput<BeginSeededGame>(seed);
+		}
+
+		//From here on, the accept thread is the only one adding inputs
+		std::thread acceptThread(&GameServer::AcceptClients, this, std::ref(game));
+		DEBUG_PRINT("Game server listening on %s", m_path.c_str());
+
+		SendOutputs(game);
+
+		//Game has stopped - wake the accept thread up wherever it's waiting
+		m_listener->Shutdown();
+		{
+			std::lock_guard lock(m_connectionMutex);
+			if (m_connection)
+			{
+				m_connection->m_socket->Shutdown();
+			}
+		}
+
+		acceptThread.join();
+		gameThread.join();
+
+		m_listener.reset();
+		std::error_code error;
+		std::filesystem::remove(m_path, error);
+		return true;
+	}
+
+	void GameServer::AcceptClients(Game& game)
+	{
+		std::vector<char> frame;
+		while (std::unique_ptr<Socket> socket = m_listener->Accept())
+		{
+			//The first frame has to introduce the client, with a version we can talk to
+			Input input;
+			if (!socket->ReceiveFrame(frame) || !DecodeInput(frame, input) || input.m_type != ConnectClient)
+			{
+				PRINT_ERR("Client didn't introduce itself - dropping it");
+				continue;
+			}
+
+			uint version = input.Get<ConnectClient>().m_version;
+			if (version != ProtocolVersion)
+			{
+				PRINT_ERR("Client speaks protocol version %u, but this server speaks %u - dropping it", version, ProtocolVersion);
+				continue;
+			}
+
+			std::shared_ptr<Connection> connection = std::make_shared<Connection>();
+			connection->m_socket = std::move(socket);
+			{
+				std::lock_guard lock(m_connectionMutex);
+				m_connection = connection;
+			}
+
+			game.AddInput(std::move(input));
+			while (!game.HasStopped() && connection->m_socket->ReceiveFrame(frame))
+			{
+				if (!DecodeInput(frame, input))
+				{
+					PRINT_ERR("Client sent a frame that doesn't decode - dropping it");
+					break;
+				}
+				game.AddInput(std::move(input));
+			}
+
+			{
+				std::lock_guard lock(m_connectionMutex);
+				if (m_connection == connection)
+				{
+					m_connection.reset();
+				}
+			}
+			DEBUG_PRINT("Client disconnected");
+
+			if (game.HasStopped())
+			{
+				return;
+			}
+		}
+	}
+
+	void GameServer::SendOutputs(Game& game)
+	{
+		while (game.WaitForOutput())
+		{
+			Output output = game.PopNextOutput();
+
+			std::shared_ptr<Connection> connection;
+			{
+				std::lock_guard lock(m_connectionMutex);
+				connection = m_connection;
+			}
+
+			//Nobody to send it to - a client that connects later starts over from scratch anyway
+			if (!connection)
+			{
+				continue;
+			}
+
+			//Anything from before the game saw this client's ConnectClient was meant for whoever was here before
+			if (!connection->m_synced)
+			{
+				connection->m_synced = (output.m_type == ClientConnected);
+				continue;
+			}
+
+			std::vector<char> frame = EncodeOutput(output);
+			if (!connection->m_socket->SendFrame(frame))
+			{
+				connection->m_socket->Shutdown();
+			}
+			ReleaseFrame(std::move(frame));
+		}
+	}
+
+	RemoteGame::~RemoteGame()
+	{
+		m_connected.store(false, std::memory_order_release);
+		WakeReceiver();
+		if (m_socket)
+		{
+			m_socket->Shutdown();
+		}
+
+		if (m_receiver.joinable())
+		{
+			m_receiver.join();
+		}
+	}
+
+	bool RemoteGame::Connect(const std::string& path)
+	{
+		m_socket = Socket::Connect(path);
+		if (!m_socket)
+		{
+			return false;
+		}
+
+		m_connected.store(true, std::memory_order_release);
+		m_receiver = std::thread(&RemoteGame::ReceiveOutputs, this);
+		CreateInput<ConnectClient>(ProtocolVersion);
+		return true;
+	}
+
+	void RemoteGame::AddInput(Input&& input)
+	{
+		if (!IsConnected())
+		{
+			return;
+		}
+
+		std::vector<char> frame = EncodeInput(input);
+		if (!m_socket->SendFrame(frame))
+		{
+			m_connected.store(false, std::memory_order_release);
+		}
+		ReleaseFrame(std::move(frame));
+	}
+
+	bool RemoteGame::HasNextOutput()
+	{
+		return !m_dropped && !m_outputs.Empty();
+	}
+
+	Output RemoteGame::PopNextOutput()
+	{
+		Output result;
+		[[maybe_unused]] bool popped = m_outputs.TryPop(result);
+		ASSERT(popped);
+		WakeReceiver();
+		return result;
+	}
+
+	void RemoteGame::Disconnect()
+	{
+		m_dropped = true;
+		m_connected.store(false, std::memory_order_release);
+		WakeReceiver();
+		if (m_socket)
+		{
+			m_socket->Shutdown();
+		}
+	}
+
+	void RemoteGame::WakeReceiver()
+	{
+		m_outputSpace.fetch_add(1, std::memory_order_release);
+		m_outputSpace.notify_one();
+	}
+
+	void RemoteGame::ReceiveOutputs()
+	{
+		std::vector<char> frame;
+		Output output;
+		while (m_socket->ReceiveFrame(frame) && DecodeOutput(frame, output))
+		{
+			while (true)
+			{
+				uint space = m_outputSpace.load(std::memory_order_acquire);
+				if (m_outputs.TryPush(std::move(output)))
+				{
+					break;
+				}
+
+				if (!IsConnected())
+				{
+					return;
+				}
+				m_outputSpace.wait(space, std::memory_order_acquire);
+			}
+		}
+
+		m_connected.store(false, std::memory_order_release);
+	}
+}
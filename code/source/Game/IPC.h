@@ -0,0 +1,118 @@
+#pragma once
+#include "GameConnection.h"
+#include "Core/Collections/SPSCQueue.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+	Server mode! Runs the game in its own process, behind a Unix domain socket, so the client can be
+	restarted or profiled without touching the simulation.
+
+	Every message is one frame - a 4 byte little endian length, then an Input or Output written to a
+	PackedStream. A client opens with ConnectClient, which also carries the protocol version; the server
+	answers with a full first send of the view, then GameReady, exactly like a local game would.
+
+	Only one client is attached at a time. When it leaves, the game keeps running and waits for the next.
+*/
+
+class Game;
+
+namespace IPC
+{
+	static constexpr uint ProtocolVersion = 4; //2 - frames use varints, 3 - plain arrays are copied whole, 4 - background saves
+	static constexpr uint MaxFrameSize = 64 * 1024 * 1024;
+	static constexpr const char* DefaultSocketPath = "RogueCpp.sock";
+
+	//A connected stream socket that speaks in frames. Blocking - each side reads on a thread of its own.
+	class Socket
+	{
+	public:
+		Socket(int handle) : m_handle(handle) {}
+		~Socket();
+
+		Socket(const Socket&) = delete;
+		Socket& operator=(const Socket&) = delete;
+
+		static std::unique_ptr<Socket> Listen(const std::string& path);
+		static std::unique_ptr<Socket> Connect(const std::string& path);
+		std::unique_ptr<Socket> Accept();
+
+		//Frames from EncodeInput / EncodeOutput already carry their length
+		bool SendFrame(std::span<const char> frame);
+		//Fills in just the payload
+		bool ReceiveFrame(std::vector<char>& frame);
+
+		//Wakes up anything blocked on this socket - they see it as closed
+		void Shutdown();
+
+	private:
+		bool SendAll(const char* data, size_t length);
+		bool ReceiveAll(char* data, size_t length);
+
+		int m_handle = -1;
+	};
+
+	//Frames are written into pooled buffers, since there's one per turn in each direction. Decoding reads a payload in place.
+	std::vector<char> EncodeInput(const Input& input);
+	std::vector<char> EncodeOutput(const Output& output);
+	bool DecodeInput(std::span<const char> frame, Input& input);
+	bool DecodeOutput(std::span<const char> frame, Output& output);
+	void ReleaseFrame(std::vector<char>&& frame);
+
+	//Hosts a game on its own thread and serves it to whichever client is connected
+	class GameServer
+	{
+	public:
+		GameServer(const std::string& path) : m_path(path) {}
+
+		//Starts (or loads) the game, then serves clients until one of them stops it. Blocks until then.
+		bool Run(const std::string& saveFile, uint seed);
+
+	private:
+		struct Connection
+		{
+			std::unique_ptr<Socket> m_socket;
+			bool m_synced = false; //Outputs only go out once the game has seen this client's ConnectClient
+		};
+
+		void AcceptClients(Game& game);
+		void SendOutputs(Game& game);
+
+		std::string m_path;
+		std::unique_ptr<Socket> m_listener;
+
+		std::mutex m_connectionMutex;
+		std::shared_ptr<Connection> m_connection;
+	};
+
+	//Client side - looks like a local game, but forwards everything to a GameServer
+	class RemoteGame : public GameConnection
+	{
+	public:
+		~RemoteGame();
+
+		bool Connect(const std::string& path);
+		bool IsConnected() const { return m_connected.load(std::memory_order_acquire); }
+
+		void AddInput(Input&& input) override;
+		bool HasNextOutput() override;
+		Output PopNextOutput() override;
+		void Disconnect() override;
+
+	private:
+		void ReceiveOutputs();
+		void WakeReceiver();
+
+		std::unique_ptr<Socket> m_socket;
+		std::thread m_receiver;
+		std::atomic<bool> m_connected = false;
+		bool m_dropped = false; //Client side only - we hung up, so whatever's still queued is from a stream we stopped trusting
+		SPSCQueue<Output, 256> m_outputs;
+		std::atomic<uint> m_outputSpace = 0; //Bumped on every pop and on hangup, so the receiver sleeps while the queue is full
+	};
+}
@@ -2,6 +2,8 @@
 #include "Data/Serialization/Serialization.h"
 #include "Game/Game.h"
 #include "LOS/TileMemory.h"
+#include "Core/Collections/BitMask.h"
+#include <bit>
 
 PlayerData::PlayerData()
 {
@@ -9,60 +11,254 @@ PlayerData::PlayerData()
 	m_backingTiles[THandle<BackingTile>()] = emptyTile;
 }
 
+namespace
+{
+	//Small unsigned values as 3 bit groups, each with a continuation bit - run lengths, index gaps
+	//and palette indices are nearly always tiny, so most cost a single nibble
+	void WriteSmallUint(PackedStream& stream, uint value)
+	{
+		do
+		{
+			uint rest = value >> 3;
+			char group = (value & 0x7) | ((rest != 0) << 3);
+			stream.WriteBits(&group, 4);
+			value = rest;
+		} while (value != 0);
+	}
+
+	uint ReadSmallUint(PackedStream& stream)
+	{
+		uint value = 0;
+		for (int shift = 0; ; shift += 3)
+		{
+			char group;
+			stream.ReadBits(&group, 4);
+			value |= uint(group & 0x7) << shift;
+			if ((group & 0x8) == 0 || shift + 3 >= 32) //Nothing we write needs more, so stop before the shift overflows
+			{
+				return value;
+			}
+		}
+	}
+
+	//Signed offsets, zigzagged so small negatives stay small
+	void WriteSmallInt(PackedStream& stream, int value)
+	{
+		WriteSmallUint(stream, (uint(value) << 1) ^ uint(value >> 31));
+	}
+
+	int ReadSmallInt(PackedStream& stream)
+	{
+		uint value = ReadSmallUint(stream);
+		return int(value >> 1) ^ -int(value & 1);
+	}
+
+	//Far beyond any radius the game sends - anything bigger came from a corrupt update
+	constexpr int MaxRemoteRadius = 1024;
+}
+
 void PlayerData::UpdateViewGame(View& newView)
 {
 	ROGUE_PROFILE_SECTION("Update view: Game side");
-	PackedStream afterStream;
+	if (!m_deltaEncoding)
+	{
+		//Raw updates carry every visible cell's change bit, so they can't be merged - anything held back goes first
+		FlushViewGame();
+
+		PackedStream afterStream = TOutput<ViewUpdated>::CreateStream();
+		WriteViewHeader(afterStream, newView);
+		WriteViewRaw(afterStream, newView);
+		afterStream.AllWritesFinished();
+		m_currentView = newView;
+		Game::game->CreateOutput<ViewUpdated>(std::move(afterStream));
+		return;
+	}
+
+	//Delta updates are held back until the game calls FlushViewGame, so a burst of turns goes out as a single
+	//update. Memory is still updated every turn - this only remembers which cells the client needs to hear about.
+	m_memory.Update(newView, [&](const View::RevealedCell& cell, const DataTile&, const DataTile&, bool changed)
+		{
+			if (changed)
+			{
+				m_pendingChanges.push_back(m_memory.m_localPosition + Vec2(cell.m_x, cell.m_y));
+			}
+		});
+
+	m_pendingView = newView;
+	m_hasPendingView = true;
+}
+
+void PlayerData::FlushViewGame()
+{
+	if (!m_hasPendingView)
+	{
+		return;
+	}
+
+	ROGUE_PROFILE_SECTION("Flush view: Game side");
+	m_hasPendingView = false;
+
+	//What the client is looking at before this update - on the first send, that's the view that gets sent with it
+	const View& clientView = hasSent ? m_currentView : m_pendingView;
 
-	int maxRadius = newView.GetRadius();
+	PackedStream afterStream = TOutput<ViewUpdated>::CreateStream();
+	WriteViewHeader(afterStream, m_pendingView);
+	WriteViewDelta(afterStream, m_pendingView, clientView);
+	afterStream.AllWritesFinished();
+
+	std::swap(m_currentView, m_pendingView);
+	Game::game->CreateOutput<ViewUpdated>(std::move(afterStream));
+}
 
-	Serialization::Write(afterStream, "First Send", !hasSent);
+void PlayerData::WriteViewHeader(PackedStream& stream, const View& newView)
+{
+	Serialization::Write(stream, "First Send", !hasSent);
 	if (!hasSent)
 	{
 		//Send all data first!
-		Serialization::Write(afterStream, "View", newView);
-		Serialization::Write(afterStream, "Memory", m_memory);
-		Serialization::Write(afterStream, "Backing Tiles", m_backingTiles);
+		Serialization::Write(stream, "View", newView);
+		Serialization::Write(stream, "Memory", m_memory);
+		Serialization::Write(stream, "Backing Tiles", m_backingTiles);
+		m_sentPaletteSize = m_memory.GetNumPaletteEntries();
 		hasSent = true;
 	}
 
-	Serialization::Write(afterStream, "MaxRadius", maxRadius);
-	Serialization::Write(afterStream, "Position", m_memory.m_localPosition);
-	for (int i = -maxRadius; i <= maxRadius; i++)
+	Serialization::Write(stream, "Delta Encoded", m_deltaEncoding);
+	Serialization::Write(stream, "MaxRadius", newView.GetRadius());
+	Serialization::Write(stream, "Position", m_memory.m_localPosition);
+}
+
+//Raw encoding - every mask word, then a bit per visible cell saying whether its tile changed
+void PlayerData::WriteViewRaw(PackedStream& stream, View& newView)
+{
+	std::span<const uint64_t> visibility = newView.GetVisibilityMask();
+	for (uint64_t word : visibility)
 	{
-		for (int j = -maxRadius; j <= maxRadius; j++)
-		{
-			bool visible = newView.GetVisibilityLocal(i, j);
-			Serialization::Write(afterStream, "Visible", visible);
+		//Mask words are dense bits - they'd only grow as varints
+		stream.Write((const char*) &word, sizeof(word));
+	}
 
-			if (visible)
+	//Revealed cells come in the same order as the mask bits, which is the order the client reads them back in
+	m_memory.Update(newView, [&](const View::RevealedCell& cell, const DataTile& oldTile, const DataTile& newTile, bool changed)
+		{
+			Serialization::Write(stream, "Update Tile", changed);
+			if (changed)
 			{
-				Location loc = newView.GetLocationLocal(i, j);
-				bool tileUpdate = (loc.GetValid() && !m_memory.ValidTile(i, j)) || (loc.GetTile() != m_memory.GetTileByLocal(i, j));
-				Serialization::Write(afterStream, "Update Tile", tileUpdate);
-				if (tileUpdate)
-				{
-					WriteTileUpdate(afterStream, i, j, m_memory.GetTileByLocal(i, j), DataTile::FromTile(loc.GetTile()));
-				}
+				WriteTileUpdate(stream, cell.m_x, cell.m_y, oldTile, newTile);
 			}
+		});
+}
+
+//Delta encoding - visibility as runs of cells that flipped since the client's view, then only the tiles
+//that changed, as gaps between their cell indices plus a palette index and temperature. Cells that changed
+//in a merged turn but are out of the view by now follow, by their offset from the player.
+void PlayerData::WriteViewDelta(PackedStream& stream, const View& newView, const View& clientView)
+{
+	ROGUE_PROFILE_SECTION("PlayerData::WriteViewDelta");
+	int numCells = newView.GetNumCells();
+	std::span<const uint64_t> visibility = newView.GetVisibilityMask();
+	m_flipped.resize(visibility.size());
+	if (clientView.GetRadius() == newView.GetRadius())
+	{
+		BitMask::Xor(m_flipped, visibility, clientView.GetVisibilityMask());
+	}
+	else
+	{
+		std::copy(visibility.begin(), visibility.end(), m_flipped.begin());
+	}
+
+	//Runs alternate unchanged / flipped, starting with unchanged
+	bool flipped = false;
+	for (int position = 0; position < numCells; flipped = !flipped)
+	{
+		int next = BitMask::FindNext(m_flipped, position, !flipped, numCells);
+		WriteSmallUint(stream, next - position);
+		position = next;
+	}
+
+	//Sorted row by row, which is also cell index order for the ones still in view. A cell that changed on several
+	//merged turns is only sent once, with whatever memory holds now.
+	std::sort(m_pendingChanges.begin(), m_pendingChanges.end(), [](const Vec2& lhs, const Vec2& rhs)
+		{
+			return lhs.y != rhs.y ? lhs.y < rhs.y : lhs.x < rhs.x;
+		});
+	m_pendingChanges.erase(std::unique(m_pendingChanges.begin(), m_pendingChanges.end()), m_pendingChanges.end());
+
+	int radius = newView.GetRadius();
+	m_changes.clear();
+	m_outsideChanges.clear();
+	for (Vec2 position : m_pendingChanges)
+	{
+		Vec2 local = position - m_memory.m_localPosition;
+		MemoryCell cell = m_memory.Encode(m_memory.GetTileByLocal(local.x, local.y));
+		if (std::abs(local.x) <= radius && std::abs(local.y) <= radius)
+		{
+			m_changes.push_back({ newView.GetIndexByLocal(local.x, local.y), cell });
 		}
+		else
+		{
+			m_outsideChanges.push_back({ local, cell });
+		}
+	}
+	m_pendingChanges.clear();
+
+	//Palette entries the client hasn't seen yet. Sent with where they start, so a replayed update lands in the same place.
+	int numEntries = m_memory.GetNumPaletteEntries();
+	WriteSmallUint(stream, m_sentPaletteSize);
+	WriteSmallUint(stream, numEntries - m_sentPaletteSize);
+	for (int i = m_sentPaletteSize; i < numEntries; i++)
+	{
+		WritePaletteEntry(stream, m_memory.m_palette[i]);
 	}
+	m_sentPaletteSize = numEntries;
 
-	m_memory.Update(newView);
+	WriteSmallUint(stream, (uint) m_changes.size());
+	int lastIndex = -1;
+	for (const TileChange& change : m_changes)
+	{
+		WriteSmallUint(stream, change.m_index - lastIndex - 1);
+		WriteCell(stream, change.m_cell);
+		lastIndex = change.m_index;
+	}
 
-	afterStream.AllWritesFinished();
-	std::shared_ptr<VectorBackend> backend = dynamic_pointer_cast<VectorBackend>(afterStream.GetDataBackend());
-	m_currentView = newView;
-	Game::game->CreateOutput<ViewUpdated>(afterStream);
+	WriteSmallUint(stream, (uint) m_outsideChanges.size());
+	for (const OutsideChange& change : m_outsideChanges)
+	{
+		WriteSmallInt(stream, change.m_local.x);
+		WriteSmallInt(stream, change.m_local.y);
+		WriteCell(stream, change.m_cell);
+	}
+}
+
+void PlayerData::WriteCell(PackedStream& stream, const MemoryCell& cell)
+{
+	WriteSmallUint(stream, cell.m_paletteIndex);
+	char temperature = cell.m_temperature;
+	stream.WriteBits(&temperature, 4);
 }
 
-void PlayerData::UpdateViewPlayer(std::shared_ptr<TOutput<ViewUpdated>> updated)
+bool PlayerData::ReadCell(PackedStream& stream, DataTile& tile)
 {
-	PackedStream stream;
+	uint paletteIndex = ReadSmallUint(stream);
+	char temperature;
+	stream.ReadBits(&temperature, 4);
+	if (paletteIndex >= m_remotePalette.size() || temperature > (char) ETemperature::Burning)
+	{
+		return false;
+	}
 
-	std::shared_ptr<VectorBackend> backend = dynamic_pointer_cast<VectorBackend>(stream.GetDataBackend());
-	ASSERT(backend != nullptr);
-	backend->m_data.insert(backend->m_data.end(), updated->m_data.begin(), updated->m_data.end());
+	const PaletteEntry& entry = m_remotePalette[paletteIndex];
+	tile.m_backingTile = entry.m_backingTile;
+	tile.m_temperature = (ETemperature) temperature;
+	tile.m_renderChar = entry.m_renderChar;
+	tile.m_color = entry.m_color;
+	return true;
+}
+
+bool PlayerData::UpdateViewPlayer(const TOutput<ViewUpdated>& updated)
+{
+	ROGUE_PROFILE_SECTION("Update view: Player side");
+	PackedStream stream = updated.OpenStream();
 
 	if (Serialization::Read<PackedStream, bool>(stream, "First Send"))
 	{
@@ -70,43 +266,199 @@ void PlayerData::UpdateViewPlayer(std::shared_ptr<TOutput<ViewUpdated>> updated)
 		Serialization::Read(stream, "View", m_currentView);
 		Serialization::Read(stream, "Memory", m_memory);
 		Serialization::Read(stream, "Backing Tiles", m_backingTiles);
+		m_remotePalette = m_memory.m_palette;
+
+		//Everything after this indexes straight into these, so a bad first send can't be patched up later
+		int radius = m_currentView.GetRadius();
+		if (stream.HasFailed() || radius < 0 || radius > MaxRemoteRadius || !m_currentView.IsValid() || !m_memory.IsValid())
+		{
+			return false;
+		}
 	}
 
+	bool deltaEncoded = Serialization::Read<PackedStream, bool>(stream, "Delta Encoded");
+
 	int newRadius;
 	Serialization::Read(stream, "MaxRadius", newRadius);
+	if (stream.HasFailed() || newRadius < 0 || newRadius > MaxRemoteRadius)
+	{
+		return false;
+	}
 
 	Vec2 newPosition;
 	Serialization::Read(stream, "Position", newPosition);
 
 	m_memory.Move(newPosition - m_memory.m_localPosition);
 
+	bool sameRadius = (m_currentView.GetRadius() == newRadius);
 	m_currentView.SetRadius(newRadius);
-	for (int i = -newRadius; i <= newRadius; i++)
+	bool valid = deltaEncoded ? ReadViewDelta(stream, sameRadius) : ReadViewRaw(stream);
+	return valid && !stream.HasFailed();
+}
+
+bool PlayerData::ReadViewRaw(PackedStream& stream)
+{
+	std::span<uint64_t> visibility = m_currentView.GetVisibilityMask();
+	for (uint64_t& word : visibility)
+	{
+		stream.Read((char*) &word, sizeof(word));
+	}
+
+	if (stream.HasFailed())
+	{
+		return false;
+	}
+
+	//Walked by hand rather than through ForEachSet so a bad tile stops us before it's written anywhere
+	int numCells = m_currentView.GetNumCells();
+	for (size_t i = 0; i < visibility.size(); i++)
 	{
-		for (int j = -newRadius; j <= newRadius; j++)
+		uint64_t word = visibility[i];
+		while (word != 0)
 		{
-			bool visible = Serialization::Read<PackedStream, bool>(stream, "Visible");
-			m_currentView.SetVisibilityLocal(i, j, visible);
+			int index = (int) (i * BitMask::BitsPerWord) + std::countr_zero(word);
+			word &= word - 1;
+			if (index >= numCells)
+			{
+				return false;
+			}
 
-			if (visible)
+			if (Serialization::Read<PackedStream, bool>(stream, "Update Tile"))
 			{
-				if (Serialization::Read<PackedStream, bool>(stream, "Update Tile"))
-				{ 
-					ReadTileUpdate(stream, i, j);
+				Vec2 local = m_currentView.GetLocalByIndex(index);
+				if (!ReadTileUpdate(stream, local.x, local.y))
+				{
+					return false;
 				}
 			}
+
+			if (stream.HasFailed())
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+bool PlayerData::ReadViewDelta(PackedStream& stream, bool sameRadius)
+{
+	ROGUE_PROFILE_SECTION("PlayerData::ReadViewDelta");
+	std::span<uint64_t> visibility = m_currentView.GetVisibilityMask();
+	if (!sameRadius)
+	{
+		std::fill(visibility.begin(), visibility.end(), 0);
+	}
+
+	//Flipped runs are applied a word at a time, unchanged runs are just skipped
+	int numCells = m_currentView.GetNumCells();
+	bool flipped = false;
+	for (int position = 0; position < numCells; flipped = !flipped)
+	{
+		uint length = ReadSmallUint(stream);
+		if (stream.HasFailed() || length > uint(numCells - position))
+		{
+			return false;
+		}
+
+		if (flipped)
+		{
+			BitMask::FlipRange(visibility, position, position + length);
+		}
+		position += length;
+	}
+
+	//New entries pick up where the last ones left off (or replay some of them), so they can't leave gaps
+	uint firstEntry = ReadSmallUint(stream);
+	uint numEntries = ReadSmallUint(stream);
+	if (firstEntry > m_remotePalette.size() || !stream.CheckReadLength(numEntries, 2))
+	{
+		return false;
+	}
+
+	m_remotePalette.resize(std::max<size_t>(m_remotePalette.size(), firstEntry + numEntries));
+	for (uint i = 0; i < numEntries; i++)
+	{
+		ReadPaletteEntry(stream, m_remotePalette[firstEntry + i]);
+	}
+
+	uint numChanges = ReadSmallUint(stream);
+	int index = -1;
+	for (uint i = 0; i < numChanges; i++)
+	{
+		uint gap = ReadSmallUint(stream);
+		DataTile tile;
+		if (gap >= uint(numCells - index - 1) || !ReadCell(stream, tile))
+		{
+			return false;
+		}
+
+		index += gap + 1;
+		Vec2 local = m_currentView.GetLocalByIndex(index);
+		m_memory.SetTileByLocal(local.x, local.y, tile);
+	}
+
+	//Each is at least two coordinates and a cell, a nibble apiece
+	uint numOutside = ReadSmallUint(stream);
+	if (!stream.CheckReadLength(numOutside, 16))
+	{
+		return false;
+	}
+
+	for (uint i = 0; i < numOutside; i++)
+	{
+		int x = ReadSmallInt(stream);
+		int y = ReadSmallInt(stream);
+		DataTile tile;
+		if (!ReadCell(stream, tile))
+		{
+			return false;
 		}
+
+		m_memory.SetTileByLocal(x, y, tile);
+	}
+
+	return true;
+}
+
+void PlayerData::WritePaletteEntry(PackedStream& stream, const PaletteEntry& entry)
+{
+	THandle<BackingTile> backing = entry.m_backingTile;
+	Serialization::Write(stream, "Handle", backing);
+
+	bool updateBacking = backing.IsValid() && !m_backingTiles.contains(backing);
+	Serialization::Write(stream, "Update backing", updateBacking);
+	if (updateBacking)
+	{
+		m_backingTiles[backing] = backing.GetReference();
+		Serialization::Write(stream, "Backing", backing.GetReference());
+	}
+
+	Serialization::Write(stream, "Char", entry.m_renderChar);
+	Serialization::Write(stream, "Color", entry.m_color);
+}
+
+void PlayerData::ReadPaletteEntry(PackedStream& stream, PaletteEntry& entry)
+{
+	Serialization::Read(stream, "Handle", entry.m_backingTile);
+
+	if (Serialization::Read<PackedStream, bool>(stream, "Update backing"))
+	{
+		m_backingTiles[entry.m_backingTile] = Serialization::Read<PackedStream, BackingTile>(stream, "Backing");
 	}
+
+	Serialization::Read(stream, "Char", entry.m_renderChar);
+	Serialization::Read(stream, "Color", entry.m_color);
 }
 
-DataTile& PlayerData::GetTileForLocal(int x, int y)
+DataTile PlayerData::GetTileForLocal(int x, int y) const
 {
 	return m_memory.GetTileByLocal(x, y);
 }
 
 BackingTile& PlayerData::GetBackingTileForLocal(int x, int y)
 {
-	DataTile& tile = m_memory.GetTileByLocal(x, y);
+	DataTile tile = GetTileForLocal(x, y);
 	return m_backingTiles[tile.m_backingTile];
 }
 
@@ -141,14 +493,17 @@ void PlayerData::WriteTileUpdate(PackedStream& stream, int x, int y, const DataT
 	}
 }
 
-void PlayerData::ReadTileUpdate(PackedStream& stream, int x, int y)
+bool PlayerData::ReadTileUpdate(PackedStream& stream, int x, int y)
 {
-	DataTile tile = m_memory.GetTileByLocal(x, y);
+	DataTile tile = GetTileForLocal(x, y);
 
 	if (Serialization::Read<PackedStream, bool>(stream, "Update backing handle"))
 	{
 		Serialization::Read(stream, "Handle", tile.m_backingTile);
-		ASSERT(tile.m_backingTile.IsValid());
+		if (stream.HasFailed() || !tile.m_backingTile.IsValid())
+		{
+			return false;
+		}
 	}
 
 	if (Serialization::Read<PackedStream, bool>(stream, "Update backing"))
@@ -164,5 +519,11 @@ void PlayerData::ReadTileUpdate(PackedStream& stream, int x, int y)
 		Serialization::Read(stream, "Color", tile.m_color);
 	}
 
+	if (stream.HasFailed() || tile.m_temperature < ETemperature::Freezing || tile.m_temperature > ETemperature::Burning)
+	{
+		return false;
+	}
+
 	m_memory.SetTileByLocal(x, y, tile);
+	return true;
 }
\ No newline at end of file
@@ -11,13 +11,36 @@ public:
 	View& GetCurrentView() { return m_currentView; }
 	TileMemory& GetCurrentMemory() { return m_memory; }
 	void UpdateViewGame(View& newView);
-	void UpdateViewPlayer(std::shared_ptr<TOutput<ViewUpdated>> updated);
-	DataTile& GetTileForLocal(int x, int y);
+	void FlushViewGame(); //Sends whatever view updates are being held back, merged into one
+	bool UpdateViewPlayer(const TOutput<ViewUpdated>& updated); //False if the update doesn't decode - the view can't be trusted after that
+	DataTile GetTileForLocal(int x, int y) const;
     BackingTile& GetBackingTileForLocal(int x, int y);
 
 private:
+    void WriteViewRaw(PackedStream& stream, View& newView);
+    void WriteViewHeader(PackedStream& stream, const View& newView);
+    void WriteViewDelta(PackedStream& stream, const View& newView, const View& clientView);
+    bool ReadViewRaw(PackedStream& stream);
+    bool ReadViewDelta(PackedStream& stream, bool sameRadius);
+
     void WriteTileUpdate(PackedStream& stream, int x, int y, const DataTile& oldTile, const DataTile& newTile);
-    void ReadTileUpdate(PackedStream& stream, int x, int y);
+    bool ReadTileUpdate(PackedStream& stream, int x, int y);
+    void WritePaletteEntry(PackedStream& stream, const PaletteEntry& entry);
+    void ReadPaletteEntry(PackedStream& stream, PaletteEntry& entry);
+    void WriteCell(PackedStream& stream, const MemoryCell& cell);
+    bool ReadCell(PackedStream& stream, DataTile& tile);
+
+    struct TileChange
+    {
+        int m_index;
+        MemoryCell m_cell;
+    };
+
+    struct OutsideChange
+    {
+        Vec2 m_local;
+        MemoryCell m_cell;
+    };
 
 public:
 	std::map<THandle<BackingTile>, BackingTile> m_backingTiles;
@@ -26,6 +49,20 @@ public:
 
     //Unsaved data
     bool hasSent = false;
+    bool m_deltaEncoding = true; //Send view updates as deltas against the client's last view, instead of whole masks
+
+private:
+    int m_sentPaletteSize = 0; //Game side - how much of the memory palette the client has
+    vector<PaletteEntry> m_remotePalette; //Player side - the game's memory palette, as far as it's been sent
+    vector<uint64_t> m_flipped;
+    vector<TileChange> m_changes;
+    vector<OutsideChange> m_outsideChanges;
+
+    //Game side - a delta update that hasn't gone out yet. Changed cells are kept in memory space, since the player
+    //may move again before it's sent.
+    View m_pendingView;
+    vector<Vec2> m_pendingChanges;
+    bool m_hasPendingView = false;
 };
 
 namespace Serialization
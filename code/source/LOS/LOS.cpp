@@ -2,18 +2,51 @@
 #include "Map/Map.h"
 #include "Debug/Profiling.h"
 #include "Core/Monster/Monster.h"
+#include "Core/Collections/StackArray.h"
+#include "Core/Collections/BitMask.h"
+#include "Data/JobSystem.h"
+#include "Game/Game.h"
 #include <algorithm>
+#include <atomic>
+#include <bit>
+
+namespace
+{
+	const Vec4 ChunkSize = Vec4(CHUNK_SIZE_X, CHUNK_SIZE_Y, CHUNK_SIZE_Z, CHUNK_SIZE_W);
+
+	uint GetTileIndex(Vec4 local)
+	{
+		return local.x + CHUNK_SIZE_X * (local.y + CHUNK_SIZE_Y * (local.z + CHUNK_SIZE_Z * local.w));
+	}
+
+	Vec4 GetTileLocal(uint index)
+	{
+		return Vec4(index % CHUNK_SIZE_X,
+			(index / CHUNK_SIZE_X) % CHUNK_SIZE_Y,
+			(index / (CHUNK_SIZE_X * CHUNK_SIZE_Y)) % CHUNK_SIZE_Z,
+			index / (CHUNK_SIZE_X * CHUNK_SIZE_Y * CHUNK_SIZE_Z));
+	}
+
+	size_t HashChunk(Vec4 chunk)
+	{
+		size_t hash = (uint) chunk.x * 73856093u;
+		hash ^= (uint) chunk.y * 19349663u;
+		hash ^= (uint) chunk.z * 83492791u;
+		hash ^= (uint) chunk.w * 50331653u;
+		return hash;
+	}
+}
 
 void View::SetRadius(int radius)
 {
 	if (m_radius != radius)
 	{
 		m_radius = radius;
+		m_cacheValid = false;
 		int diameter = (2 * radius) + 1;
 		int numTiles = diameter * diameter;
-		m_locations.resize(numTiles);
-		m_visibility.resize(numTiles);
-		m_rotations.resize(numTiles);
+		m_cells.resize(numTiles);
+		m_visibility.resize(BitMask::GetNumWords(numTiles));
 		
 #ifdef DEBUG_HOTSPOTS
 		m_heat.resize(numTiles);
@@ -26,17 +59,17 @@ void View::SetRadiusOnlyUpsize(int radius)
 	int diameter = (2 * radius) + 1;
 	int numTiles = diameter * diameter;
 
-	if (m_locations.size() < numTiles)
+	if (m_cells.size() < (size_t) numTiles)
 	{
-		m_locations.resize(numTiles);
-		m_visibility.resize(numTiles);
-		m_rotations.resize(numTiles);
+		m_cells.resize(numTiles);
+		m_visibility.resize(BitMask::GetNumWords(numTiles));
 #ifdef DEBUG_HOTSPOTS
 		m_heat.resize(numTiles);
 #endif
 	}
 
 	m_radius = radius;
+	m_cacheValid = false;
 }
 
 int View::GetIndexByLocal(int x, int y) const
@@ -48,17 +81,77 @@ int View::GetIndexByLocal(int x, int y) const
 	return (x + m_radius) + (y + m_radius) * (2 * m_radius + 1);
 }
 
-void View::ResetAt(Location location)
+Vec2 View::GetLocalByIndex(int index) const
 {
 	int diameter = (2 * m_radius) + 1;
-	int numTiles = diameter * diameter;
+	return Vec2((index % diameter) - m_radius, (index / diameter) - m_radius);
+}
+
+int View::GetNumCells() const
+{
+	if (m_radius < 0) { return 0; }
+	int diameter = (2 * m_radius) + 1;
+	return diameter * diameter;
+}
+
+bool View::IsValid() const
+{
+	int numCells = GetNumCells();
+	if (m_cells.size() < (size_t) numCells || m_visibility.size() < (size_t) BitMask::GetNumWords(numCells))
+	{
+		return false;
+	}
+
+	return std::all_of(m_cells.begin(), m_cells.begin() + numCells, [&](uint cell)
+		{
+			uint slot = cell >> SlotShift;
+			return slot == InvalidSlot || slot < m_chunks.size();
+		});
+}
+
+std::span<const uint64_t> View::GetVisibilityMask() const
+{
+	return std::span<const uint64_t>(m_visibility.data(), BitMask::GetNumWords(GetNumCells()));
+}
+
+std::span<uint64_t> View::GetVisibilityMask()
+{
+	return std::span<uint64_t>(m_visibility.data(), BitMask::GetNumWords(GetNumCells()));
+}
+
+int View::GetNumVisible() const
+{
+	return BitMask::Count(GetVisibilityMask());
+}
+
+void View::GetRevealed(vector<RevealedCell>& outCells) const
+{
+	ROGUE_PROFILE_SECTION("View::GetRevealed");
+	outCells.clear();
+	BitMask::ForEachSet(GetVisibilityMask(), [&](int index)
+		{
+			Vec2 local = GetLocalByIndex(index);
+			outCells.push_back({ index, (short) local.x, (short) local.y, GetLocationLocal(local.x, local.y) });
+		});
+}
+
+void View::ResetAt(Location location)
+{
+	int numTiles = GetNumCells();
 
-	std::fill(m_locations.begin(), m_locations.begin() + numTiles, Location());
-	std::fill(m_visibility.begin(), m_visibility.begin() + numTiles, 0);
-	std::fill(m_rotations.begin(), m_rotations.begin() + numTiles, North);
+	std::fill(m_cells.begin(), m_cells.begin() + numTiles, EmptyCell);
+	std::fill(m_visibility.begin(), m_visibility.begin() + BitMask::GetNumWords(numTiles), 0);
 
-	m_locations[GetIndexByLocal(0, 0)] = location;
-	m_visibility[GetIndexByLocal(0, 0)] = 1;
+	m_chunks.clear();
+	std::fill(m_chunkLookup.begin(), m_chunkLookup.end(), InvalidSlot);
+	m_lastSlot = InvalidSlot;
+
+	SetLocationLocal(0, 0, location);
+	SetVisibilityLocal(0, 0, true);
+
+	m_cacheValid = false;
+	m_chunkStamps.clear();
+	TouchChunk(location);
 
 #ifdef DEBUG_HOTSPOTS
 	std::fill(m_heat.begin(), m_heat.begin() + numTiles, 0);
@@ -68,45 +161,120 @@ void View::ResetAt(Location location)
 #endif
 }
 
-void View::Mark(int x, int y, uchar value)
-{
-	m_visibility[GetIndexByLocal(x, y)] = value;
-}
-
 Location View::GetLocationLocal(int x, int y) const
 {
-	return m_locations[GetIndexByLocal(x, y)];
-}
+	uint cell = m_cells[GetIndexByLocal(x, y)];
+	uint slot = cell >> SlotShift;
+	if (slot == InvalidSlot)
+	{
+		return Location();
+	}
 
-bool View::GetVisibilityLocal(int x, int y) const
-{
-	return m_visibility[GetIndexByLocal(x, y)] > 0;
+	Vec4 local = GetTileLocal((cell & TileMask) >> RotationBits);
+	return Location(m_chunks[slot] * ChunkSize + local);
 }
 
-uchar View::GetVisibilityPassIndex(int x, int y) const
+bool View::GetVisibilityLocal(int x, int y) const
 {
-	ROGUE_PROFILE_SECTION("View::GetVisibilityPassIndex");
-	return m_visibility[GetIndexByLocal(x, y)];
+	return BitMask::Get(m_visibility, GetIndexByLocal(x, y));
 }
 
 Direction View::GetRotationLocal(int x, int y) const
 {
-	return m_rotations[GetIndexByLocal(x, y)];
+	return (Direction) (m_cells[GetIndexByLocal(x, y)] & RotationMask);
 }
 
 void View::SetLocationLocal(int x, int y, Location location)
 {
-	m_locations[GetIndexByLocal(x, y)] = location;
+	uint& cell = m_cells[GetIndexByLocal(x, y)];
+	uint packed = EmptyCell;
+	if (location.GetValid())
+	{
+		Vec4 position = location.GetVector();
+		packed = (FindOrAddChunk(position / ChunkSize) << SlotShift) | (GetTileIndex(position % ChunkSize) << RotationBits);
+	}
+
+	cell = packed | (cell & RotationMask);
 }
 
 void View::SetRotationLocal(int x, int y, Direction direction)
 {
-	m_rotations[GetIndexByLocal(x, y)] = direction;
+	uint& cell = m_cells[GetIndexByLocal(x, y)];
+	cell = (cell & ~RotationMask) | ((uint) direction & RotationMask);
 }
 
 void View::SetVisibilityLocal(int x, int y, bool visible)
 {
-	m_visibility[GetIndexByLocal(x, y)] = visible;
+	BitMask::Set(m_visibility, GetIndexByLocal(x, y), visible);
+}
+
+uint View::FindOrAddChunk(Vec4 chunk)
+{
+	//Rows walk along chunks, so most lookups hit the same chunk as the last one
+	if (m_lastSlot != InvalidSlot && m_chunks[m_lastSlot] == chunk)
+	{
+		return m_lastSlot;
+	}
+
+	//Keep the lookup at most half full
+	if (m_chunkLookup.size() < (m_chunks.size() + 1) * 2)
+	{
+		m_chunkLookup.resize(std::max<size_t>(64, m_chunkLookup.size() * 2));
+		RebuildChunkLookup();
+	}
+
+	size_t mask = m_chunkLookup.size() - 1;
+	for (size_t i = HashChunk(chunk) & mask; ; i = (i + 1) & mask)
+	{
+		uint slot = m_chunkLookup[i];
+		if (slot == InvalidSlot)
+		{
+			slot = (uint) m_chunks.size();
+			ASSERT(slot < InvalidSlot);
+			m_chunks.push_back(chunk);
+			m_chunkLookup[i] = slot;
+			m_lastSlot = slot;
+			return slot;
+		}
+
+		if (m_chunks[slot] == chunk)
+		{
+			m_lastSlot = slot;
+			return slot;
+		}
+	}
+}
+
+void View::RebuildChunkLookup()
+{
+	m_lastSlot = InvalidSlot;
+	if (m_chunkLookup.size() < m_chunks.size() * 2)
+	{
+		m_chunkLookup.resize(std::max<size_t>(64, std::bit_ceil(m_chunks.size() * 2)));
+	}
+
+	std::fill(m_chunkLookup.begin(), m_chunkLookup.end(), InvalidSlot);
+	size_t mask = m_chunkLookup.size() - 1;
+	for (uint slot = 0; slot < m_chunks.size(); slot++)
+	{
+		size_t i = HashChunk(m_chunks[slot]) & mask;
+		while (m_chunkLookup[i] != InvalidSlot)
+		{
+			i = (i + 1) & mask;
+		}
+		m_chunkLookup[i] = slot;
+	}
+}
+
+void View::TouchChunk(Location location)
+{
+	if (!location.GetValid()) { return; }
+
+	//Rows walk along chunks, so most touches repeat the last one - skip those here, and dedupe the rest when stamping
+	Vec4 chunk = location.GetChunkPosition();
+	if (!m_chunkStamps.empty() && m_chunkStamps.back().m_chunk == chunk) { return; }
+
+	m_chunkStamps.push_back({ chunk, ChunkMap::InvalidVisionGeneration });
 }
 
 void View::Debug_AddHeatLocal(int x, int y)
@@ -166,6 +334,14 @@ float View::Debug_GetHeatPercentageLocal(int x, int y)
 #endif
 }
 
+namespace
+{
+	bool ChunkOrder(const Vec4& lhs, const Vec4& rhs)
+	{
+		return std::tie(lhs.w, lhs.z, lhs.y, lhs.x) < std::tie(rhs.w, rhs.z, rhs.y, rhs.x);
+	}
+}
+
 namespace LOS
 {
 	void Calculate(THandle<Monster> monster, uchar maxPass)
@@ -174,102 +350,681 @@ namespace LOS
 		Calculate(monster->GetView(), monster->GetLocation(), monster->GetRotation(), maxPass);
 	}
 
+	Context& GetThreadContext()
+	{
+		static thread_local Context context;
+		return context;
+	}
+
 	void Calculate(View& view, Location location, Direction rotation, uchar maxPass)
+	{
+		Calculate(GetThreadContext(), view, location, rotation, maxPass);
+	}
+
+	void Calculate(Context& context, View& view, Location location, Direction rotation, uchar maxPass, Kernel kernel)
 	{
 		ROGUE_PROFILE_SECTION("LOS::Calculate");
+		if (IsCacheValid(view, location, rotation, maxPass))
+		{
+			ROGUE_PROFILE_SECTION("LOS::Calculate - Cached");
+			return;
+		}
+
+		BeginCast(context, view, location);
+
+		//Iterate each quadrant once
+		CalculateQuadrant(view, context, West,  rotation, maxPass, kernel);
+		CalculateQuadrant(view, context, East,  rotation, maxPass, kernel);
+		CalculateQuadrant(view, context, North, rotation, maxPass, kernel);
+		CalculateQuadrant(view, context, South, rotation, maxPass, kernel);
+
+		//Incomplete - leave the view uncached so the caller's recast can't be skipped
+		if (context.m_missedChunk) { return; }
+
+		StampCache(view, context.m_scratch.m_chunkStamps, location, rotation, maxPass);
+
+#ifdef LOS_GOLDEN_COMPARE
+		if (kernel == Kernel::Iterative)
+		{
+			static thread_local Context goldenContext;
+			static thread_local View golden;
+			goldenContext.m_readOnly = context.m_readOnly;
+			golden.SetRadius(view.GetRadius());
+			golden.Invalidate();
+			Calculate(goldenContext, golden, location, rotation, maxPass, Kernel::Recursive);
+			ASSERT(ViewsMatch(view, golden));
+		}
+#endif
+	}
+
+	bool CompareKernels(View& view, Location location, Direction rotation, uchar maxPass)
+	{
+		ROGUE_PROFILE_SECTION("LOS::CompareKernels");
+		static thread_local View golden;
+		golden.SetRadius(view.GetRadius());
+		golden.Invalidate();
+		view.Invalidate();
+
+		Context& context = GetThreadContext();
+		Calculate(context, golden, location, rotation, maxPass, Kernel::Recursive);
+		Calculate(context, view, location, rotation, maxPass, Kernel::Iterative);
+		return ViewsMatch(view, golden);
+	}
+
+	void BeginCast(Context& context, View& view, Location location)
+	{
 		//Set scratch to match, iff it's smaller than needed
-		static View scratch;
+		View& scratch = context.m_scratch;
 		scratch.SetRadiusOnlyUpsize(view.GetRadius());
 
 		//Reset the views
 		view.ResetAt(location);
 		scratch.ResetAt(location);
 
-		//Iterate each quadrant once
-		CalculateQuadrant(view, scratch, West,  rotation, maxPass);
-		CalculateQuadrant(view, scratch, East,  rotation, maxPass);
-		CalculateQuadrant(view, scratch, North, rotation, maxPass);
-		CalculateQuadrant(view, scratch, South, rotation, maxPass);
+		int numTiles = scratch.GetNumCells();
+		if (context.m_passes.size() < (size_t) numTiles)
+		{
+			context.m_passes.resize(numTiles);
+		}
+		std::fill(context.m_passes.begin(), context.m_passes.begin() + numTiles, 0);
+		context.m_passes[scratch.GetIndexByLocal(0, 0)] = 1;
+		context.m_missedChunk = false;
+
+		bool useTable = context.m_useColumnTables && view.GetRadius() <= ColumnTable::MaxRadius;
+		context.m_columns = useTable ? &ColumnTable::Get() : nullptr;
+	}
+
+	ColumnTable::ColumnTable(int radius) : m_radius(radius)
+	{
+		ROGUE_PROFILE_SECTION("LOS::ColumnTable");
+		m_blockStarts.resize(radius + 1);
+		int size = 0;
+		for (int created = 1; created <= radius; created++)
+		{
+			m_blockStarts[created] = size;
+			size += ((4 * created) + 3) * (radius - created + 1);
+		}
+
+		m_minCols.resize(size);
+		m_maxCols.resize(size);
+		for (int created = 1; created <= radius; created++)
+		{
+			for (int slopeIndex = 0; slopeIndex <= (4 * created) + 2; slopeIndex++)
+			{
+				Fraction slope = Fraction(slopeIndex - (2 * created) - 1, 2 * created);
+				for (int depth = created; depth <= radius; depth++)
+				{
+					int index = GetIndex(depth, slope);
+					int minCol = FractionMultiplyRoundUp(depth, slope);
+					int maxCol = FractionMultiplyRoundDown(depth, slope);
+					ASSERT(minCol >= INT8_MIN && minCol <= INT8_MAX && maxCol >= INT8_MIN && maxCol <= INT8_MAX);
+					m_minCols[index] = (int8_t) minCol;
+					m_maxCols[index] = (int8_t) maxCol;
+				}
+			}
+		}
+	}
+
+	const ColumnTable& ColumnTable::Get()
+	{
+		static const ColumnTable table(MaxRadius);
+		return table;
+	}
+
+	void CalculateParallel(View& view, Location location, Direction rotation, uchar maxPass)
+	{
+		ROGUE_PROFILE_SECTION("LOS::CalculateParallel");
+		if (IsCacheValid(view, location, rotation, maxPass))
+		{
+			ROGUE_PROFILE_SECTION("LOS::CalculateParallel - Cached");
+			return;
+		}
+
+		{
+			//Workers never stream - load everything within the radius up front so they rarely need to. Portals can lead
+			//anywhere though, so if a quadrant reaches an unloaded chunk the whole cast is redone serially below.
+			ROGUE_PROFILE_SECTION("LOS::CalculateParallel - Stream");
+			ChunkMap* map = GetDataManager()->ResolveByTypeIndex<ChunkMap>(0);
+			int chunkRadius = IntDivisionCeil(view.GetRadius(), std::min(CHUNK_SIZE_X, CHUNK_SIZE_Y));
+			map->TriggerStreamingAroundLocation(location, Vec4(chunkRadius, chunkRadius, 0, 0));
+			map->WaitForStreaming();
+		}
+
+		//Each quadrant gets its own output view and context, owned by the calling thread so nothing is shared between workers
+		struct QuadrantCast
+		{
+			QuadrantCast(Direction direction) : m_direction(direction)
+			{
+				m_context.m_readOnly = true;
+			}
+
+			Direction m_direction;
+			View m_view;
+			Context m_context;
+		};
+
+		static thread_local QuadrantCast casts[4] = { { West }, { East }, { North }, { South } };
+
+		RogueDataManager* dataManager = Game::dataManager;
+		MaterialManager* materialManager = Game::materialManager;
+		WorldManager* worldManager = Game::worldManager;
+
+		std::atomic<int> remaining = 4;
+		for (QuadrantCast& cast : casts)
+		{
+			cast.m_view.SetRadius(view.GetRadius());
+			QuadrantCast* castPtr = &cast;
+			Jobs::QueueJob([castPtr, &remaining, location, rotation, maxPass, dataManager, materialManager, worldManager]()
+				{
+					ROGUE_PROFILE_SECTION("LOS::CalculateParallel - Quadrant");
+					Game::dataManager = dataManager;
+					Game::materialManager = materialManager;
+					Game::worldManager = worldManager;
+
+					BeginCast(castPtr->m_context, castPtr->m_view, location);
+					CalculateQuadrant(castPtr->m_view, castPtr->m_context, castPtr->m_direction, rotation, maxPass);
+
+					remaining.fetch_sub(1);
+				});
+		}
+
+		{
+			ROGUE_PROFILE_SECTION("LOS::CalculateParallel - Wait");
+			while (remaining.load() > 0)
+			{
+				Jobs::Poll();
+			}
+		}
+
+		for (QuadrantCast& cast : casts)
+		{
+			if (cast.m_context.m_missedChunk)
+			{
+				//Back on the calling thread, where streaming is safe
+				ROGUE_PROFILE_SECTION("LOS::CalculateParallel - Recast");
+				view.Invalidate();
+				Calculate(view, location, rotation, maxPass);
+				return;
+			}
+		}
+
+		//Merge in the same order as the serial cast, so that cells on the shared diagonals resolve the same way
+		ROGUE_PROFILE_SECTION("LOS::CalculateParallel - Merge");
+		static thread_local vector<uchar> passes;
+		passes.assign(view.GetNumCells(), 0);
+		passes[view.GetIndexByLocal(0, 0)] = 1;
+
+		view.ResetAt(location);
+		vector<View::ChunkStamp> touched;
+		for (QuadrantCast& cast : casts)
+		{
+			MergeQuadrant(view, passes, cast.m_view, cast.m_context, cast.m_direction);
+			touched.insert(touched.end(), cast.m_context.m_scratch.m_chunkStamps.begin(), cast.m_context.m_scratch.m_chunkStamps.end());
+		}
+
+		StampCache(view, touched, location, rotation, maxPass);
+	}
+
+	void MergeQuadrant(View& view, vector<uchar>& passes, const View& quadrantView, const Context& quadrantContext, Direction direction)
+	{
+		//Replays the quadrant's final writes through the same rule the kernel uses - a cell keeps the lowest pass that
+		//reached it, and on a tie the last quadrant wins. That's exactly where the serial cast ends up.
+		const int radius = view.GetRadius();
+		for (int depth = 1; depth <= radius; depth++)
+		{
+			for (int col = -depth; col <= depth; col++)
+			{
+				Vec2 pos = Transform(direction, col, depth);
+				uchar pass = quadrantContext.m_passes[quadrantContext.m_scratch.GetIndexByLocal(pos.x, pos.y)];
+				if (pass == 0) { continue; }
+
+				uchar& current = passes[view.GetIndexByLocal(pos.x, pos.y)];
+				if (current == 0 || current >= pass)
+				{
+					current = pass;
+					view.SetLocationLocal(pos.x, pos.y, quadrantView.GetLocationLocal(pos.x, pos.y));
+					view.SetRotationLocal(pos.x, pos.y, quadrantView.GetRotationLocal(pos.x, pos.y));
+					view.SetVisibilityLocal(pos.x, pos.y, true);
+				}
+			}
+		}
+
+#ifdef DEBUG_HOTSPOTS
+		for (int i = 0; i < view.GetNumCells(); i++)
+		{
+			view.m_heat[i] += quadrantView.m_heat[i];
+			view.m_maxHeat = std::max(view.m_heat[i], view.m_maxHeat);
+		}
+		view.m_sumHeat += quadrantView.m_sumHeat;
+		view.m_numRevealed = view.GetNumVisible() - 1;
+#endif
+	}
+
+	bool CompareParallel(View& view, Location location, Direction rotation, uchar maxPass)
+	{
+		ROGUE_PROFILE_SECTION("LOS::CompareParallel");
+		static thread_local View serial;
+		serial.SetRadius(view.GetRadius());
+		serial.Invalidate();
+		view.Invalidate();
+
+		Calculate(serial, location, rotation, maxPass);
+		CalculateParallel(view, location, rotation, maxPass);
+		return ViewsMatch(view, serial);
+	}
+
+	bool IsCacheValid(const View& view, Location location, Direction rotation, uchar maxPass)
+	{
+		ROGUE_PROFILE_SECTION("LOS::IsCacheValid");
+		if (!view.m_cacheValid) { return false; }
+		if (!(view.m_cacheLocation == location) || view.m_cacheRotation != rotation || view.m_cacheMaxPass != maxPass) { return false; }
+
+		ChunkMap* map = GetDataManager()->ResolveByTypeIndex<ChunkMap>(0);
+		for (const View::ChunkStamp& stamp : view.m_chunkStamps)
+		{
+			if (map->GetVisionGeneration(stamp.m_chunk) != stamp.m_generation)
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	void StampCache(View& view, const vector<View::ChunkStamp>& touched, Location location, Direction rotation, uchar maxPass)
+	{
+		ROGUE_PROFILE_SECTION("LOS::StampCache");
+		//Scratch has seen every tile the cast read, including ones that were never revealed
+		view.m_chunkStamps = touched;
+		std::sort(view.m_chunkStamps.begin(), view.m_chunkStamps.end(), [](const View::ChunkStamp& lhs, const View::ChunkStamp& rhs)
+			{
+				return ChunkOrder(lhs.m_chunk, rhs.m_chunk);
+			});
+		auto last = std::unique(view.m_chunkStamps.begin(), view.m_chunkStamps.end(), [](const View::ChunkStamp& lhs, const View::ChunkStamp& rhs)
+			{
+				return lhs.m_chunk == rhs.m_chunk;
+			});
+		view.m_chunkStamps.erase(last, view.m_chunkStamps.end());
+
+		ChunkMap* map = GetDataManager()->ResolveByTypeIndex<ChunkMap>(0);
+		for (View::ChunkStamp& stamp : view.m_chunkStamps)
+		{
+			stamp.m_generation = map->GetVisionGeneration(stamp.m_chunk);
+		}
+
+		view.m_cacheLocation = location;
+		view.m_cacheRotation = rotation;
+		view.m_cacheMaxPass = maxPass;
+		view.m_cacheValid = true;
 	}
 
-	void CalculateQuadrant(View& view, View& scratch, Direction direction, Direction rotation, uchar maxPass)
+	bool ViewsMatch(const View& lhs, const View& rhs)
+	{
+		if (lhs.m_radius != rhs.m_radius) { return false; }
+
+		//Chunk slots are handed out in visiting order, so compare what the cells decode to rather than the raw cells
+		int radius = lhs.m_radius;
+		for (int y = -radius; y <= radius; y++)
+		{
+			for (int x = -radius; x <= radius; x++)
+			{
+				if (lhs.GetVisibilityLocal(x, y) != rhs.GetVisibilityLocal(x, y)) { return false; }
+				if (!(lhs.GetLocationLocal(x, y) == rhs.GetLocationLocal(x, y))) { return false; }
+				if (lhs.GetRotationLocal(x, y) != rhs.GetRotationLocal(x, y)) { return false; }
+			}
+		}
+
+		return true;
+	}
+
+	void GetNewlyVisible(const View& current, const View& previous, vector<uint64_t>& outMask)
+	{
+		ASSERT(current.m_radius == previous.m_radius);
+		std::span<const uint64_t> currentMask = current.GetVisibilityMask();
+		outMask.resize(currentMask.size());
+		BitMask::AndNot(outMask, currentMask, previous.GetVisibilityMask());
+	}
+
+	void GetNoLongerVisible(const View& current, const View& previous, vector<uint64_t>& outMask)
+	{
+		GetNewlyVisible(previous, current, outMask);
+	}
+
+	void GetVisibleByAny(std::span<const View*> views, vector<uint64_t>& outMask)
+	{
+		outMask.clear();
+		if (views.empty()) { return; }
+
+		std::span<const uint64_t> first = views[0]->GetVisibilityMask();
+		outMask.assign(first.begin(), first.end());
+		for (size_t i = 1; i < views.size(); i++)
+		{
+			ASSERT(views[i]->m_radius == views[0]->m_radius);
+			BitMask::Or(outMask, outMask, views[i]->GetVisibilityMask());
+		}
+	}
+
+	void CalculateBatch(std::span<THandle<Monster>> monsters, uchar maxPass)
+	{
+		ROGUE_PROFILE_SECTION("LOS::CalculateBatch");
+		ROGUE_PROFILE_VALUE("LOS Batch Size", (int64_t) monsters.size());
+		if (monsters.empty()) { return; }
+
+		//One group would only ever run on this thread - skip the sort and the streaming pass
+		if (monsters.size() <= BatchGroupSize)
+		{
+			for (THandle<Monster> monster : monsters)
+			{
+				Calculate(monster, maxPass);
+			}
+			return;
+		}
+
+		//Sort by chunk, so each group covers as few chunks as possible
+		struct Entry
+		{
+			Vec4 m_chunk;
+			THandle<Monster> m_monster;
+		};
+
+		vector<Entry> entries;
+		entries.reserve(monsters.size());
+		for (THandle<Monster> monster : monsters)
+		{
+			ASSERT(monster.IsValid());
+			entries.push_back({ monster->GetLocation().GetChunkPosition(), monster });
+		}
+
+		std::sort(entries.begin(), entries.end(), [](const Entry& lhs, const Entry& rhs)
+			{
+				return ChunkOrder(lhs.m_chunk, rhs.m_chunk);
+			});
+
+		{
+			//Workers never stream - load everything within each radius up front so they rarely need to. Portals can lead
+			//anywhere though, so a cast that reaches an unloaded chunk is handed back and redone below.
+			ROGUE_PROFILE_SECTION("LOS::CalculateBatch - Stream");
+			ChunkMap* map = GetDataManager()->ResolveByTypeIndex<ChunkMap>(0);
+			for (size_t i = 0; i < entries.size(); i++)
+			{
+				if (i > 0 && entries[i].m_chunk == entries[i - 1].m_chunk) { continue; }
+
+				View& view = entries[i].m_monster->GetView();
+				int chunkRadius = IntDivisionCeil(view.GetRadius(), std::min(CHUNK_SIZE_X, CHUNK_SIZE_Y));
+				map->TriggerStreamingAroundLocation(entries[i].m_monster->GetLocation(), Vec4(chunkRadius, chunkRadius, 0, 0));
+			}
+			map->WaitForStreaming();
+		}
+
+		//Groups are handed out from a shared counter, so the jobs (and this thread) each take the next one as they finish.
+		//It's shared, because a job that only starts once every group is done still needs somewhere to find that out.
+		struct BatchState
+		{
+			vector<Entry> m_entries;
+			vector<uchar> m_missed; //Each group only writes its own entries
+			int m_numGroups = 0;
+			std::atomic<int> m_nextGroup = 0;
+			std::atomic<int> m_finishedGroups = 0;
+		};
+
+		auto state = std::make_shared<BatchState>();
+		state->m_entries = std::move(entries);
+		state->m_missed.assign(state->m_entries.size(), 0);
+		state->m_numGroups = IntDivisionCeil((int) state->m_entries.size(), BatchGroupSize);
+
+		auto castGroups = [](BatchState& state, uchar maxPass)
+		{
+			Context& context = GetThreadContext();
+			context.m_readOnly = true;
+			int finished = 0;
+			for (int group = state.m_nextGroup.fetch_add(1); group < state.m_numGroups; group = state.m_nextGroup.fetch_add(1))
+			{
+				ROGUE_PROFILE_SECTION("LOS::CalculateBatch - Group");
+				int start = group * BatchGroupSize;
+				int end = std::min(start + BatchGroupSize, (int) state.m_entries.size());
+				for (int i = start; i < end; i++)
+				{
+					//A cache hit returns before the cast resets this, so clear it here or the last miss carries over
+					THandle<Monster> monster = state.m_entries[i].m_monster;
+					context.m_missedChunk = false;
+					Calculate(context, monster->GetView(), monster->GetLocation(), monster->GetRotation(), maxPass);
+					state.m_missed[i] = context.m_missedChunk;
+				}
+				finished++;
+			}
+			context.m_readOnly = false;
+
+			if (finished > 0 && state.m_finishedGroups.fetch_add(finished) + finished == state.m_numGroups)
+			{
+				state.m_finishedGroups.notify_one();
+			}
+		};
+
+		RogueDataManager* dataManager = Game::dataManager;
+		MaterialManager* materialManager = Game::materialManager;
+		WorldManager* worldManager = Game::worldManager;
+
+		//This thread takes groups too, so it only needs help with the rest
+		int numJobs = std::min((int) Jobs::GetNumWorkers(), state->m_numGroups - 1);
+		for (int i = 0; i < numJobs; i++)
+		{
+			Jobs::QueueJob([state, castGroups, maxPass, dataManager, materialManager, worldManager]()
+				{
+					Game::dataManager = dataManager;
+					Game::materialManager = materialManager;
+					Game::worldManager = worldManager;
+					castGroups(*state, maxPass);
+				});
+		}
+
+		castGroups(*state, maxPass);
+
+		{
+			ROGUE_PROFILE_SECTION("LOS::CalculateBatch - Wait");
+			for (int finished = state->m_finishedGroups.load(); finished < state->m_numGroups; finished = state->m_finishedGroups.load())
+			{
+				state->m_finishedGroups.wait(finished);
+			}
+		}
+
+		{
+			//Back on the main thread, where streaming is safe - recast anything that ran off the loaded map
+			ROGUE_PROFILE_SECTION("LOS::CalculateBatch - Recast");
+			for (size_t i = 0; i < state->m_entries.size(); i++)
+			{
+				if (!state->m_missed[i]) { continue; }
+
+				THandle<Monster> monster = state->m_entries[i].m_monster;
+				Calculate(monster->GetView(), monster->GetLocation(), monster->GetRotation(), maxPass);
+			}
+		}
+	}
+
+	void CalculateQuadrant(View& view, Context& context, Direction direction, Direction rotation, uchar maxPass, Kernel kernel)
 	{
 		ROGUE_PROFILE_SECTION("LOS::CalculateQuadrant");
 		Row start = Row(1, 1, Fraction(-1, 1), Fraction(1, 1));
-		scratch.SetRotationLocal(0, 0, rotation);
-		Scan(view, scratch, direction, start, maxPass);
+		context.m_scratch.SetRotationLocal(0, 0, rotation);
+
+		if (kernel == Kernel::Iterative)
+		{
+			ScanIterative(view, context, direction, start, maxPass);
+		}
+		else
+		{
+			Scan(view, context, direction, start, maxPass);
+		}
+	}
+
+	//Same walk as Scan, with each recursive call turned into a pushed frame. Every row pushed is one
+	//deeper than the row that pushed it, and the end-of-row scan replaces its parent, so the stack
+	//never holds more than radius frames.
+	void ScanIterative(View& view, Context& context, Direction direction, const Row& startRow, uchar maxPass)
+	{
+		ROGUE_PROFILE_SECTION("LOS::ScanIterative");
+		const int radius = view.GetRadius();
+
+		STACKARRAY(ScanFrame, stack, radius + 1);
+		auto push = [&](const Row& row)
+		{
+			if (row.m_depth > radius) { return false; }
+			if (row.m_pass > maxPass) { return false; }
+			stack.push_back(ScanFrame(row, context.m_columns));
+			return true;
+		};
+
+		push(startRow);
+
+		while (!stack.empty())
+		{
+			ScanFrame& frame = stack.last();
+			Row& row = frame.m_row;
+
+			if (frame.m_stage == ScanFrame::Column)
+			{
+				if (frame.m_col > frame.m_maxCol)
+				{
+					//Row finished - scan next row in place of this one
+					Row nextRow = Row(row.m_pass, row.m_depth + 1, row.m_startSlope, row.m_endSlope);
+					bool open = !BlocksVision(frame.m_prevTile);
+					stack.resize(stack.size() - 1);
+
+					if (open)
+					{
+						push(nextRow);
+					}
+					continue;
+				}
+
+				int col = frame.m_col;
+				Vec2 pos = Transform(direction, col, row.m_depth);
+				auto move = GetTileByRowParent(view, context, direction, col, row);
+				view.Debug_AddHeatLocal(pos.x, pos.y);
+
+				Location tile = move.first;
+				Direction rotation = move.second;
+				VisionTile vision = GetVisionTile(context, tile);
+				frame.m_tile = vision;
+
+				if ((IsWall(vision) || IsSymmetric(row, col)))
+				{
+					if (ShouldOverwrite(context, pos.x, pos.y, row.m_pass))
+					{
+						SetTile(view, direction, col, row.m_depth, tile);
+						SetRotation(view, direction, col, row.m_depth, rotation);
+						Reveal(view, context, direction, col, row.m_depth, row.m_pass);
+					}
+				}
+				if (BlocksVision(frame.m_prevTile) && AllowsVision(vision))
+				{
+					row.m_startSlope = Slope(col, row.m_depth);
+				}
+
+				frame.m_stage = ScanFrame::Blocker;
+				if (AllowsVision(frame.m_prevTile) && BlocksVision(vision))
+				{
+					//Move to next row!
+					if (push(Row(row.m_pass, row.m_depth + 1, row.m_startSlope, Slope(col, row.m_depth))))
+					{
+						continue;
+					}
+				}
+			}
+
+			if (frame.m_stage == ScanFrame::Blocker)
+			{
+				frame.m_stage = ScanFrame::Portal;
+				if (IsFloor(frame.m_tile) && RequiresRecast(frame.m_tile))
+				{
+					//This is a portal - scan recursive pass through it's sightlines
+					Fraction min = std::max(row.m_startSlope, Slope(frame.m_col, row.m_depth));
+					Fraction max = std::min(row.m_endSlope, OppositeSlope(frame.m_col, row.m_depth));
+					if (push(Row(row.m_pass + 1, row.m_depth + 1, min, max)))
+					{
+						continue;
+					}
+				}
+			}
+
+			//Column finished
+			frame.m_prevTile = frame.m_tile;
+			frame.m_col++;
+			frame.m_stage = ScanFrame::Column;
+		}
 	}
 
-	void Scan(View& view, View& scratch, Direction direction, Row& row, uchar maxPass)
+	void Scan(View& view, Context& context, Direction direction, Row& row, uchar maxPass)
 	{
 		ROGUE_PROFILE_SECTION("LOS::Scan");
 		if (row.m_depth > view.GetRadius()) { return; }
 		if (row.m_pass > maxPass) { return; }
 
-		int minCol = row.GetMinCol();
-		int maxCol = row.GetMaxCol();
+		int minCol = row.GetMinCol(context.m_columns);
+		int maxCol = row.GetMaxCol(context.m_columns);
 
-		Location prevTile = Location();
+		VisionTile prevTile = VisionTile();
 
 		for (int col = minCol; col <= maxCol; col++)
 		{
 			Vec2 pos = Transform(direction, col, row.m_depth);
-			auto move = GetTileByRowParent(view, scratch, direction, col, row);
+			auto move = GetTileByRowParent(view, context, direction, col, row);
 			view.Debug_AddHeatLocal(pos.x, pos.y);
 
 			Location tile = move.first;
 			Direction rotation = move.second;
+			VisionTile vision = GetVisionTile(context, tile);
 
-			if ((IsWall(tile) || IsSymmetric(row, col)))
+			if ((IsWall(vision) || IsSymmetric(row, col)))
 			{
-				if (ShouldOverwrite(view, pos.x, pos.y, row.m_pass))
+				if (ShouldOverwrite(context, pos.x, pos.y, row.m_pass))
 				{
 					SetTile(view, direction, col, row.m_depth, tile);
 					SetRotation(view, direction, col, row.m_depth, rotation);
-					Reveal(view, direction, col, row.m_depth, row.m_pass);
+					Reveal(view, context, direction, col, row.m_depth, row.m_pass);
 				}
 			}
-			if (BlocksVision(prevTile) && AllowsVision(tile))
+			if (BlocksVision(prevTile) && AllowsVision(vision))
 			{
 				row.m_startSlope = Slope(col, row.m_depth);
 			}
-			if (AllowsVision(prevTile) && BlocksVision(tile))
+			if (AllowsVision(prevTile) && BlocksVision(vision))
 			{
 				//Move to next row!
 				Row nextRow = Row(row.m_pass, row.m_depth + 1, row.m_startSlope, Slope(col, row.m_depth));
-				Scan(view, scratch, direction, nextRow, maxPass);
+				Scan(view, context, direction, nextRow, maxPass);
 			}
-			if (IsFloor(tile) && RequiresRecast(tile))
+			if (IsFloor(vision) && RequiresRecast(vision))
 			{
 				//This is a portal - scan recursive pass through it's sightlines
 				Fraction min = std::max(row.m_startSlope, Slope(col, row.m_depth));
 				Fraction max = std::min(row.m_endSlope, OppositeSlope(col, row.m_depth));
 				Row recurseRow = Row(row.m_pass + 1, row.m_depth + 1, min, max);
-				Scan(view, scratch, direction, recurseRow, maxPass);
+				Scan(view, context, direction, recurseRow, maxPass);
 			}
 
-			prevTile = tile;
+			prevTile = vision;
 		}
 
 		if (!BlocksVision(prevTile))
 		{
 			//Scan next row!
 			Row nextRow = Row(row.m_pass, row.m_depth + 1, row.m_startSlope, row.m_endSlope);
-			Scan(view, scratch, direction, nextRow, maxPass);
+			Scan(view, context, direction, nextRow, maxPass);
 		}
 	}
 
-	std::pair<Location, Direction> GetTileByRowParent(View& view, View& scratch, Direction direction, int col, const Row& row)
+	std::pair<Location, Direction> GetTileByRowParent(View& view, Context& context, Direction direction, int col, const Row& row)
 	{
 		ROGUE_PROFILE_SECTION("LOS::GetTileByRowParent");
+		View& scratch = context.m_scratch;
 		Fraction minSlope = row.m_startSlope;
 		Fraction maxSlope = row.m_endSlope;
 
 		int parentRow = row.m_depth - 1;
 
 		//Scan Phase - Search back to the most recent, visible, same pass parent
-		int minCol = FractionMultiplyRoundUp(parentRow, minSlope);
-		int maxCol = FractionMultiplyRoundDown(parentRow, maxSlope);
+		int minCol = GetMinCol(context.m_columns, parentRow, minSlope);
+		int maxCol = GetMaxCol(context.m_columns, parentRow, maxSlope);
 
 		//Bounding box snap for location
 		int parentCol = std::min(std::max(minCol, col), maxCol);
@@ -281,10 +1036,18 @@ namespace LOS
 
 		ASSERT(std::abs(offset.x) <= 1 && std::abs(offset.y) <= 1);
 
+		if (context.m_missedChunk)
+		{
+			//This cast is getting thrown out - don't follow any more tiles, they could lead further into unloaded chunks
+			SetTile(scratch, direction, col, row.m_depth, Location());
+			return std::make_pair(Location(), North);
+		}
+
 		Location parent = GetTile(scratch, direction, parentCol, parentRow);
 		Direction parentDir = GetRotation(scratch, direction, parentCol, parentRow);
 
 		auto childMove = parent.Traverse(offset, parentDir);
+		scratch.TouchChunk(childMove.first);
 
 		//No matter what, write this tile into the scratch pad. Our recursions will either ignore it spatially or need it set.
 		SetTile(scratch, direction, col, row.m_depth, childMove.first);
@@ -297,9 +1060,9 @@ namespace LOS
 
 	//Determines if a new entry can overwrite an existing one.
 	//Switching this logic allows blocking walls to show up, but removes some of the sightlines guarantees
-	bool ShouldOverwrite(const View& view, int col, int row, uchar pass)
+	bool ShouldOverwrite(const Context& context, int col, int row, uchar pass)
 	{
-		uchar current = view.GetVisibilityPassIndex(col, row);
+		uchar current = context.m_passes[context.m_scratch.GetIndexByLocal(col, row)];
 		return (current == 0) || (current >= pass);
 	}
 
@@ -335,37 +1098,6 @@ namespace LOS
 		view.SetRotationLocal(pos.x, pos.y, rotation);
 	}
 
-	Vec2 Transform(Direction direction, int col, int row)
-	{
-		ROGUE_PROFILE_SECTION("LOS::Transform");
-		int x = 0;
-		int y = 0;
-
-		switch (direction)
-		{
-		case North:
-			x = col;
-			y = row;
-			break;
-		case East:
-			x = row;
-			y = col;
-			break;
-		case South:
-			x = col;
-			y = -row;
-			break;
-		case West:
-			x = -row;
-			y = col;
-			break;
-		default:
-			break;
-		}
-
-		return Vec2(x, y);
-	}
-
 	bool IsSymmetric(const Row& row, int col)
 	{
 		return IsSymmetric(col, row.m_depth, row.m_startSlope, row.m_endSlope);
@@ -378,32 +1110,50 @@ namespace LOS
 		return withinLower && withinUpper;
 	}
 
+	VisionTile GetVisionTile(Location location)
+	{
+		if (!location.GetValid()) { return VisionTile(); }
+		return GetDataManager()->ResolveByTypeIndex<ChunkMap>(0)->GetVisionTile(location);
+	}
+
+	VisionTile GetVisionTile(Context& context, Location location)
+	{
+		if (!context.m_readOnly) { return GetVisionTile(location); }
+
+		VisionTile tile;
+		if (!GetDataManager()->ResolveByTypeIndex<ChunkMap>(0)->TryGetVisionTile(location, tile))
+		{
+			context.m_missedChunk = true;
+		}
+		return tile;
+	}
+
 	bool IsWall(Location location)
 	{
-		return location.GetValid() && location->m_wall;
+		return IsWall(GetVisionTile(location));
 	}
 
 	bool IsFloor(Location location)
 	{
-		return location.GetValid() && !location->m_wall;
+		return IsFloor(GetVisionTile(location));
 	}
 
 	bool RequiresRecast(Location location)
 	{
-		return location.GetValid() && location.HasNeighbors();
+		return RequiresRecast(GetVisionTile(location));
 	}
 
 	bool BlocksVision(Location location)
 	{
-		return IsWall(location) || RequiresRecast(location);
+		return BlocksVision(GetVisionTile(location));
 	}
 
 	bool AllowsVision(Location location)
 	{
-		return IsFloor(location) && !RequiresRecast(location);
+		return AllowsVision(GetVisionTile(location));
 	}
 
-	void Reveal(View& view, Direction direction, int col, int row, uchar pass)
+	void Reveal(View& view, Context& context, Direction direction, int col, int row, uchar pass)
 	{
 		ROGUE_PROFILE_SECTION("LOS::Reveal");
 		Vec2 pos = Transform(direction, col, row);
@@ -415,7 +1165,8 @@ namespace LOS
 		}
 #endif
 
-		view.Mark(pos.x, pos.y, pass);
+		view.SetVisibilityLocal(pos.x, pos.y, true);
+		context.m_passes[context.m_scratch.GetIndexByLocal(pos.x, pos.y)] = pass;
 	}
 
 	Fraction Slope(int col, int row)
@@ -1,5 +1,6 @@
 #pragma once
 #include "Core/CoreDataTypes.h"
+#include <span>
 #include <vector>
 
 /*
@@ -11,6 +12,11 @@
 	moves are allowed to create new rows, and that new rows resolve their world-space
 	position by using linear interpolation to choose a resolved parent and iterate from
 	them.
+
+	The default kernel (ScanIterative) walks rows with an explicit stack instead of
+	recursing. It visits rows in exactly the same order as the recursive Scan, which is
+	kept around as the reference implementation - rows share the scratch view, so the
+	visiting order is part of the output.
 */
 
 class BackingTile;
@@ -26,6 +32,9 @@ using namespace std;
 #define DEBUG_HOTSPOTS
 #endif
 
+//Checks every cast against the recursive kernel, and asserts if they disagree. Very slow!
+//#define LOS_GOLDEN_COMPARE
+
 class View
 {
 public:
@@ -33,17 +42,15 @@ public:
 
 	void SetRadius(int radius);
 	void SetRadiusOnlyUpsize(int radius);
-	int GetRadius() { return m_radius; }
+	int GetRadius() const { return m_radius; }
 	void ResetAt(Location location);
 
 	int GetIndexByLocal(int x, int y) const;
-
-	void Mark(int x, int y, uchar value);
+	Vec2 GetLocalByIndex(int index) const;
 
 	//Getters
 	Location GetLocationLocal(int x, int y) const;
 	bool GetVisibilityLocal(int x, int y) const;
-	uchar GetVisibilityPassIndex(int x, int y) const;
 	Direction GetRotationLocal(int x, int y) const;
 
 	//Setters
@@ -51,6 +58,11 @@ public:
 	void SetRotationLocal(int x, int y, Direction direction);
 	void SetVisibilityLocal(int x, int y, bool visible);
 
+	//Cache - a view remembers where it was cast from, and the vision generation of every chunk that cast read.
+	//If none of that has changed, casting again would give the exact same result.
+	void TouchChunk(Location location);
+	void Invalidate() { m_cacheValid = false; }
+
 	//Debug tools (should compile out)
 	void Debug_AddHeatLocal(int x, int y);
 	int Debug_GetHeatLocal(int x, int y);
@@ -59,11 +71,66 @@ public:
 	int Debug_GetNumRevealed();
 	float Debug_GetHeatPercentageLocal(int x, int y);
 
+	//Cells are packed into 32 bits - a slot in this view's chunk table, the tile's index inside that chunk,
+	//and the rotation. A view only ever covers a few hundred chunks, so this stays lossless at a quarter of
+	//the size of a Location.
+	static constexpr uint RotationBits = 3;
+	static constexpr uint TileBits = 6;
+	static constexpr uint SlotShift = RotationBits + TileBits;
+	static constexpr uint RotationMask = (1u << RotationBits) - 1;
+	static constexpr uint TileMask = ((1u << TileBits) - 1) << RotationBits;
+	static constexpr uint InvalidSlot = MAX_UINT >> SlotShift;
+	static constexpr uint EmptyCell = InvalidSlot << SlotShift;
+	static_assert(CHUNK_SIZE_X * CHUNK_SIZE_Y * CHUNK_SIZE_Z * CHUNK_SIZE_W <= (1 << TileBits), "Packed cells need room for every tile in a chunk");
+
+	int GetNumCells() const;
+	void RebuildChunkLookup();
+
+	//Buffers cover the radius and every cell points at a real chunk. Only needed for views that came from outside.
+	bool IsValid() const;
+
+	//Visibility as a packed bitmask, one bit per cell in index order
+	std::span<const uint64_t> GetVisibilityMask() const;
+	std::span<uint64_t> GetVisibilityMask();
+	int GetNumVisible() const;
+
+	//Every visible cell and the location it shows, in index order. Only built when asked for, into the caller's
+	//buffer, so consumers pay for what's visible instead of the whole square - and casts don't pay at all.
+	struct RevealedCell
+	{
+		int m_index;
+		short m_x;
+		short m_y;
+		Location m_location;
+	};
+
+	void GetRevealed(vector<RevealedCell>& outCells) const;
+
+private:
+	uint FindOrAddChunk(Vec4 chunk);
+
 public:
 	int m_radius = -1;
-	vector<Location> m_locations;
-	vector<uchar> m_visibility;
-	vector<Direction> m_rotations;
+	vector<uint> m_cells;
+	vector<uint64_t> m_visibility; //One bit per cell
+	vector<Vec4> m_chunks; //Chunk table, indexed by the slot in each cell
+
+	//Open addressed chunk -> slot lookup, only used while writing cells. Rebuilt on load.
+	vector<uint> m_chunkLookup;
+	uint m_lastSlot = InvalidSlot;
+
+	struct ChunkStamp
+	{
+		Vec4 m_chunk;
+		uint64_t m_generation;
+	};
+
+	bool m_cacheValid = false;
+	Location m_cacheLocation;
+	Direction m_cacheRotation = North;
+	uchar m_cacheMaxPass = 0;
+	vector<ChunkStamp> m_chunkStamps;
+
 #ifdef DEBUG_HOTSPOTS
 	vector<int> m_heat;
 	int m_maxHeat = 0;
@@ -108,6 +175,71 @@ namespace LOS
 		return (lhs.m_numerator * rhs.m_denominator) > (lhs.m_denominator * rhs.m_numerator);
 	}
 
+	//Column bounds for every slope a row can have, at every depth it can reach. Row slopes are always (2c +- 1) / 2d
+	//for some column and depth inside the radius (or the starting -1 and 1), so there are only about 2r^2 of them,
+	//and each is only ever used at or below the depth that created it. Generated once, for the largest radius we
+	//use - which covers every smaller one too. Anything outside the table falls back to the arithmetic.
+	class ColumnTable
+	{
+	public:
+		static constexpr int MaxRadius = 60;
+
+		ColumnTable(int radius);
+		static const ColumnTable& Get();
+
+		int GetRadius() const { return m_radius; }
+
+		int GetMinCol(int depth, Fraction slope) const
+		{
+			int index = GetIndex(depth, slope);
+			return index >= 0 ? m_minCols[index] : FractionMultiplyRoundUp(depth, slope);
+		}
+
+		int GetMaxCol(int depth, Fraction slope) const
+		{
+			int index = GetIndex(depth, slope);
+			return index >= 0 ? m_maxCols[index] : FractionMultiplyRoundDown(depth, slope);
+		}
+
+	private:
+		int GetIndex(int depth, Fraction slope) const
+		{
+			int numerator = slope.m_numerator;
+			int created = slope.m_denominator / 2;
+			if (slope.m_denominator == 1)
+			{
+				numerator *= 2;
+				created = 1;
+			}
+			else if (slope.m_denominator & 1)
+			{
+				return -1;
+			}
+
+			if (created < 1 || created > m_radius || depth < created || depth > m_radius) { return -1; }
+
+			int slopeIndex = numerator + (2 * created) + 1;
+			if (slopeIndex < 0 || slopeIndex > (4 * created) + 2) { return -1; }
+
+			return m_blockStarts[created] + slopeIndex * (m_radius - created + 1) + (depth - created);
+		}
+
+		int m_radius;
+		vector<int> m_blockStarts; //Start of each creating depth's slopes, which are laid out depth-minor
+		vector<int8_t> m_minCols;
+		vector<int8_t> m_maxCols;
+	};
+
+	inline int GetMinCol(const ColumnTable* table, int depth, Fraction slope)
+	{
+		return table ? table->GetMinCol(depth, slope) : FractionMultiplyRoundUp(depth, slope);
+	}
+
+	inline int GetMaxCol(const ColumnTable* table, int depth, Fraction slope)
+	{
+		return table ? table->GetMaxCol(depth, slope) : FractionMultiplyRoundDown(depth, slope);
+	}
+
 	struct Row
 	{
 		uchar m_pass;
@@ -121,26 +253,99 @@ namespace LOS
 			m_startSlope(startSlope),
 			m_endSlope(endSlope){}
 
-		int GetMinCol()
+		int GetMinCol(const ColumnTable* table = nullptr) const
 		{
-			return FractionMultiplyRoundUp(m_depth, m_startSlope);
+			return LOS::GetMinCol(table, m_depth, m_startSlope);
 		}
 
-		int GetMaxCol()
+		int GetMaxCol(const ColumnTable* table = nullptr) const
 		{
-			return FractionMultiplyRoundDown(m_depth, m_endSlope);
+			return LOS::GetMaxCol(table, m_depth, m_endSlope);
 		}
 	};
 
+	//One suspended row for the iterative kernel - the locals of a recursive Scan call
+	struct ScanFrame
+	{
+		enum Stage : uchar
+		{
+			Column,	//About to visit m_col
+			Blocker, //Returned from the row spawned by a blocker, portal check is next
+			Portal //Returned from the portal recast, column is finished
+		};
+
+		Row m_row;
+		int m_col;
+		int m_maxCol;
+		VisionTile m_prevTile;
+		VisionTile m_tile;
+		Stage m_stage;
+
+		ScanFrame(const Row& row, const ColumnTable* table) :
+			m_row(row),
+			m_col(m_row.GetMinCol(table)),
+			m_maxCol(m_row.GetMaxCol(table)),
+			m_stage(Column) {}
+	};
+
+	enum class Kernel : uchar
+	{
+		Iterative,
+		Recursive
+	};
+
+	//Working memory for a single shadowcast. Nothing in here outlives a Calculate call, so any thread can
+	//compute LOS at the same time as any other, as long as each uses its own context.
+	struct Context
+	{
+		View m_scratch;
+		vector<uchar> m_passes; //Pass each output cell was revealed on, indexed like the scratch view
+		const ColumnTable* m_columns = nullptr; //Set per cast, when the radius is covered by the table
+		bool m_useColumnTables = true;
+		bool m_readOnly = false; //Set on job workers - unloaded chunks are recorded as a miss instead of streamed
+		bool m_missedChunk = false; //Set when a read-only cast reached an unloaded chunk, and has to be redone on the main thread
+	};
+
+	//Lazily created context owned by the calling thread
+	Context& GetThreadContext();
+
 	//Core shadowcasting
 	void Calculate(THandle<Monster> monster, uchar maxPass = 255);
 	void Calculate(View& view, Location location, Direction rotation, uchar maxPass = 255);
-	void CalculateQuadrant(View& view, View& scratch, Direction direction, Direction rotation, uchar maxPass);
-	void Scan(View& view, View& scratch, Direction direction, Row& row, uchar maxPass);
+	void Calculate(Context& context, View& view, Location location, Direction rotation, uchar maxPass = 255, Kernel kernel = Kernel::Iterative);
+
+	//Batched shadowcasting - calculates every monster's view across the job workers and the calling thread, returning
+	//once all are done. Monsters are grouped by chunk so that each worker stays in the same part of the map.
+	//Batches of one group or less are just cast serially.
+	static constexpr int BatchGroupSize = 8;
+	void CalculateBatch(std::span<THandle<Monster>> monsters, uchar maxPass = 255);
+
+	//Opt-in for very large radii (scrying, towers, spectators) - casts each quadrant on its own job worker, with
+	//its own scratch, and merges them in the serial quadrant order. The result is identical to Calculate.
+	void CalculateParallel(View& view, Location location, Direction rotation, uchar maxPass = 255);
+	void MergeQuadrant(View& view, vector<uchar>& passes, const View& quadrantView, const Context& quadrantContext, Direction direction);
+	void BeginCast(Context& context, View& view, Location location);
+	void CalculateQuadrant(View& view, Context& context, Direction direction, Direction rotation, uchar maxPass, Kernel kernel = Kernel::Iterative);
+	void Scan(View& view, Context& context, Direction direction, Row& row, uchar maxPass);
+	void ScanIterative(View& view, Context& context, Direction direction, const Row& row, uchar maxPass);
+
+	//Incremental support - checks a view's cache stamp against the map, and stamps it after a cast
+	bool IsCacheValid(const View& view, Location location, Direction rotation, uchar maxPass);
+	void StampCache(View& view, const vector<View::ChunkStamp>& touched, Location location, Direction rotation, uchar maxPass);
+
+	//Visibility queries - views must share a radius, and are compared cell for cell in view-local space
+	void GetNewlyVisible(const View& current, const View& previous, vector<uint64_t>& outMask);
+	void GetNoLongerVisible(const View& current, const View& previous, vector<uint64_t>& outMask);
+	void GetVisibleByAny(std::span<const View*> views, vector<uint64_t>& outMask);
+
+	//Golden comparison - casts with both kernels and checks that the results match exactly
+	bool CompareKernels(View& view, Location location, Direction rotation, uchar maxPass = 255);
+	bool CompareParallel(View& view, Location location, Direction rotation, uchar maxPass = 255);
+	bool ViewsMatch(const View& lhs, const View& rhs);
 
 	//Recursive mapping
-	std::pair<Location, Direction> GetTileByRowParent(View& view, View& scratch, Direction direction, int col, const Row& row);
-	bool ShouldOverwrite(const View& view, int col, int row, uchar pass);
+	std::pair<Location, Direction> GetTileByRowParent(View& view, Context& context, Direction direction, int col, const Row& row);
+	bool ShouldOverwrite(const Context& context, int col, int row, uchar pass);
 
 	Location GetTile(View& view, Direction direction, int col, int row);
 	void SetTile(View& view, Direction direction, int col, int row, Location location);
@@ -149,15 +354,50 @@ namespace LOS
 	void SetRotation(View& view, Direction direction, int col, int row, Direction rotation);
 
 	//Utility functions
-	Vec2 Transform(Direction direction, int col, int row);
+	//Quadrant transforms as an index remap - x = col * colX + row * rowX, y = col * colY + row * rowY.
+	//Indexed by direction, only the cardinal directions are quadrants.
+	struct QuadrantTransform
+	{
+		int m_colX;
+		int m_rowX;
+		int m_colY;
+		int m_rowY;
+	};
+
+	inline constexpr QuadrantTransform QuadrantTransforms[8] =
+	{
+		{ 1, 0, 0, 1 }, //North
+		{ 0, 0, 0, 0 },
+		{ 0, 1, 1, 0 }, //East
+		{ 0, 0, 0, 0 },
+		{ 1, 0, 0, -1 }, //South
+		{ 0, 0, 0, 0 },
+		{ 0, -1, 1, 0 }, //West
+		{ 0, 0, 0, 0 }
+	};
+
+	inline Vec2 Transform(Direction direction, int col, int row)
+	{
+		const QuadrantTransform& transform = QuadrantTransforms[direction];
+		return Vec2(col * transform.m_colX + row * transform.m_rowX, col * transform.m_colY + row * transform.m_rowY);
+	}
 	bool IsSymmetric(const Row& row, int col);
 	bool IsSymmetric(const int col, const int row, const Fraction start, const Fraction end);
+	VisionTile GetVisionTile(Location location);
+	VisionTile GetVisionTile(Context& context, Location location);
 	bool IsWall(Location location);
 	bool IsFloor(Location location);
 	bool RequiresRecast(Location location);
 	bool BlocksVision(Location location);
 	bool AllowsVision(Location location);
-	void Reveal(View& view, Direction direction, int col, int row, uchar pass);
+
+	//Mask versions, used by the kernels - one chunk lookup per tile instead of one per question
+	inline bool IsWall(VisionTile tile) { return tile.m_valid && tile.m_wall; }
+	inline bool IsFloor(VisionTile tile) { return tile.m_valid && !tile.m_wall; }
+	inline bool RequiresRecast(VisionTile tile) { return tile.m_valid && tile.m_portal; }
+	inline bool BlocksVision(VisionTile tile) { return IsWall(tile) || RequiresRecast(tile); }
+	inline bool AllowsVision(VisionTile tile) { return IsFloor(tile) && !RequiresRecast(tile); }
+	void Reveal(View& view, Context& context, Direction direction, int col, int row, uchar pass);
 	Fraction Slope(int col, int row);
 	Fraction CenterSlope(int col, int row);
 	Fraction OppositeSlope(int col, int row);
@@ -165,6 +405,7 @@ namespace LOS
 
 namespace Serialization
 {
+	//Saved as part of player data - changing this layout needs a new save version (see RogueSaveManager::version)
 	template<>
 	struct Serializer<View> : ObjectSerializer<View>
 	{
@@ -172,9 +413,9 @@ namespace Serialization
 		static void Serialize(Stream& stream, const View& value)
 		{
 			Write(stream, "Radius", value.m_radius);
-			Write(stream, "Locations", value.m_locations);
+			Write(stream, "Cells", value.m_cells);
+			Write(stream, "Chunks", value.m_chunks);
 			Write(stream, "Visibility", value.m_visibility);
-			Write(stream, "Rotations", value.m_rotations);
 
 #ifdef DEBUG_HOTSPOTS
 			Write(stream, "Hotspots", value.m_heat);
@@ -185,9 +426,10 @@ namespace Serialization
 		static void Deserialize(Stream& stream, View& value)
 		{
 			Read(stream, "Radius", value.m_radius);
-			Read(stream, "Locations", value.m_locations);
+			Read(stream, "Cells", value.m_cells);
+			Read(stream, "Chunks", value.m_chunks);
 			Read(stream, "Visibility", value.m_visibility);
-			Read(stream, "Rotations", value.m_rotations);
+			value.RebuildChunkLookup();
 
 #ifdef DEBUG_HOTSPOTS
 			Read(stream, "Hotspots", value.m_heat);
@@ -2,8 +2,6 @@
 #include "Map/Map.h"
 #include "Data/SaveManager.h"
 #include "Data/RogueDataManager.h"
-#include "Render/Windows/Window.h"
-#include "Render/Terminal.h"
 #include "LOS.h"
 #include "Game/Game.h"
 #include <algorithm>
@@ -50,6 +48,7 @@ DataTile DataTile::FromTile(const Tile& tile)
 		data.m_renderChar = material.floorChar;
 	}
 	data.m_color = material.color;
+	data.m_fromBacking = !tile.m_stats.IsValid();
 	return data;
 }
 
@@ -66,44 +65,164 @@ bool DataTile::operator==(const Tile& other)
 	return (m_backingTile == other.m_backingTile) && (m_temperature == TemperatureFromHeat(other.m_heat) && (m_renderChar == renderChar) && (m_color == color));
 }
 
-TileMemory::TileMemory()
+bool DataTile::operator==(const DataTile& other) const
+{
+	return (m_backingTile == other.m_backingTile) && (m_temperature == other.m_temperature) && (m_renderChar == other.m_renderChar) && (m_color == other.m_color);
+}
+
+bool PaletteEntry::operator==(const PaletteEntry& other) const
+{
+	return (m_backingTile == other.m_backingTile) && (m_renderChar == other.m_renderChar) && (m_color == other.m_color);
+}
+
+size_t PaletteEntryHash::operator()(const PaletteEntry& entry) const
+{
+	uint64_t key = (uint64_t(entry.m_backingTile.GetInternalOffset()) << 32) | entry.m_color.color;
+	return std::hash<uint64_t>()(key ^ (uint64_t((uchar) entry.m_renderChar) << 56));
+}
+
+void MemoryCell::SetPacked(uint packed)
+{
+	m_paletteIndex = packed & MAX_USHORT;
+	m_temperature = (packed >> 16) & 0xF;
+	m_fromBacking = (packed >> 20) & 1;
+}
+
+MemoryPage::MemoryPage()
+{
+	m_cells.resize(PAGE_TILES, MemoryCell());
+}
+
+MemoryCell MemoryPage::GetCell(int index) const
 {
-	m_tiles.resize(MEMORY_BUFFER_SIZE, DataTile());
+	if (!IsCold())
+	{
+		return m_cells[index];
+	}
+
+	for (const TileRun& run : m_runs)
+	{
+		if (index < run.m_count)
+		{
+			return run.m_cell;
+		}
+		index -= run.m_count;
+	}
 
-#ifdef DEBUG
-	Debug_CheckIndexingDuplicates();
-#endif
+	HALT();
+	return MemoryCell();
+}
+
+void MemoryPage::Expand(std::span<MemoryCell, PAGE_TILES> cells) const
+{
+	if (!IsCold())
+	{
+		std::copy(m_cells.begin(), m_cells.end(), cells.begin());
+		return;
+	}
+
+	auto it = cells.begin();
+	for (const TileRun& run : m_runs)
+	{
+		it = std::fill_n(it, run.m_count, run.m_cell);
+	}
+	ASSERT(it == cells.end());
 }
 
-void TileMemory::Update(View& los)
+bool MemoryPage::Freeze()
 {
-	for (int x = -los.GetRadius(); x <= los.GetRadius(); x++)
+	if (IsCold()) { return true; }
+
+	m_runs.clear();
+	for (const MemoryCell& cell : m_cells)
 	{
-		for (int y = -los.GetRadius(); y <= los.GetRadius(); y++)
+		if (!m_runs.empty() && m_runs.back().m_cell == cell)
+		{
+			m_runs.back().m_count++;
+		}
+		else
 		{
-			if (los.GetVisibilityLocal(x, y))
-			{
-				SetTileByLocal(x, y, los.GetLocationLocal(x, y));
-			}
+			m_runs.push_back({ 1, cell });
 		}
 	}
+
+	//Runs are bigger than cells, so a noisy page can come out larger than it went in - keep those hot
+	if (m_runs.size() * sizeof(TileRun) >= PAGE_TILES * sizeof(MemoryCell))
+	{
+		vector<TileRun>().swap(m_runs);
+		return false;
+	}
+
+	m_runs.shrink_to_fit();
+	vector<MemoryCell>().swap(m_cells);
+	return true;
+}
+
+void MemoryPage::Thaw()
+{
+	if (!IsCold()) { return; }
+
+	m_cells.reserve(PAGE_TILES);
+	for (const TileRun& run : m_runs)
+	{
+		m_cells.insert(m_cells.end(), run.m_count, run.m_cell);
+	}
+
+	ASSERT(m_cells.size() == PAGE_TILES);
+	vector<TileRun>().swap(m_runs);
+}
+
+bool MemoryPage::IsValid(size_t paletteSize) const
+{
+	auto validCell = [&](const MemoryCell& cell) { return cell.m_paletteIndex < paletteSize; };
+	if (!IsCold())
+	{
+		return m_cells.size() == PAGE_TILES && std::all_of(m_cells.begin(), m_cells.end(), validCell);
+	}
+
+	uint count = 0;
+	for (const TileRun& run : m_runs)
+	{
+		if (!validCell(run.m_cell)) { return false; }
+		count += run.m_count;
+	}
+	return count == PAGE_TILES;
+}
+
+size_t MemoryPage::GetResidentBytes() const
+{
+	return sizeof(MemoryPage) + (m_cells.capacity() * sizeof(MemoryCell)) + (m_runs.capacity() * sizeof(TileRun));
+}
+
+TileMemory::TileMemory()
+{
+	Wipe();
+}
+
+void TileMemory::Update(const View& los)
+{
+	Update(los, [](const View::RevealedCell&, const DataTile&, const DataTile&, bool) {});
 }
 
 void TileMemory::Wipe()
 {
-	std::fill(m_tiles.begin(), m_tiles.end(), DataTile());
+	m_pages.clear();
+	m_hotPages.clear();
+	m_palette.assign(1, PaletteEntry());
+	RebuildPaletteLookup();
 }
 
 void TileMemory::Move(Vec2 offset)
 {
 	ROGUE_PROFILE_SECTION("TileMemory::Move");
-	//Pre move - need to wipe out the edges of this map!
-	WipeLocalRect(Vec2(0, -MEMORY_RADIUS), Vec2(MEMORY_SIZE, 1));
-	WipeLocalRect(Vec2(0, MEMORY_RADIUS), Vec2(MEMORY_SIZE, 1));
-	WipeLocalRect(Vec2(-MEMORY_RADIUS, 0), Vec2(1, MEMORY_SIZE));
-	WipeLocalRect(Vec2(MEMORY_RADIUS, 0), Vec2(1, MEMORY_SIZE));
-
+	Vec2 oldPage = GetPagePosition(m_localPosition);
 	m_localPosition += offset;
+
+	//Only worth sweeping when the player crosses into a new page
+	if (GetPagePosition(m_localPosition) != oldPage)
+	{
+		FreezeDistantPages();
+	}
 }
 
 void TileMemory::SetLocalPosition(Location location)
@@ -114,99 +233,184 @@ void TileMemory::SetLocalPosition(Location location)
 void TileMemory::SetTileByLocal(int x, int y, Location location)
 {
 	ASSERT(location.GetValid());
-	x = ModulusNegative<int>(x + m_localPosition.x, MEMORY_SIZE);
-	y = ModulusNegative<int>(y + m_localPosition.y, MEMORY_SIZE);
-
-	m_tiles[IndexIntoTilemap(x, y)] = DataTile::FromTile(location.GetTile());
+	SetTileByLocal(x, y, DataTile::FromTile(location.GetTile()));
 }
 
 void TileMemory::SetTileByLocal(int x, int y, const Tile& tile)
 {
-	x = ModulusNegative<int>(x + m_localPosition.x, MEMORY_SIZE);
-	y = ModulusNegative<int>(y + m_localPosition.y, MEMORY_SIZE);
-
-	m_tiles[IndexIntoTilemap(x, y)] = DataTile::FromTile(tile);
+	SetTileByLocal(x, y, DataTile::FromTile(tile));
 }
 
 void TileMemory::SetTileByLocal(int x, int y, const DataTile& tile)
 {
-	x = ModulusNegative<int>(x + m_localPosition.x, MEMORY_SIZE);
-	y = ModulusNegative<int>(y + m_localPosition.y, MEMORY_SIZE);
+	MemoryCell cell = Encode(tile);
+	GetCellByLocal(x, y) = cell;
+}
 
-	m_tiles[IndexIntoTilemap(x, y)] = tile;
+//Memory has no edges anymore - anywhere the player could look has somewhere to go
+bool TileMemory::ValidTile(int, int) const
+{
+	return true;
 }
 
-bool TileMemory::ValidTile(int x, int y)
+DataTile TileMemory::GetTileByLocal(int x, int y) const
 {
-	x = ModulusNegative<int>(x + m_localPosition.x, MEMORY_SIZE);
-	y = ModulusNegative<int>(y + m_localPosition.y, MEMORY_SIZE);
+	Vec2 position = m_localPosition + Vec2(x, y);
+	const MemoryPage* page = FindPage(GetPagePosition(position));
+	if (page == nullptr)
+	{
+		return Decode(MemoryCell());
+	}
 
-	return (x >= 0 && x < MEMORY_SIZE && y >= 0 && y < MEMORY_SIZE);
+	return Decode(page->GetCell(GetIndexInPage(position)));
 }
 
-DataTile& TileMemory::GetTileByLocal(int x, int y)
+MemoryCell TileMemory::Encode(const DataTile& tile)
 {
-	ASSERT(ValidTile(x, y));
-	x = ModulusNegative<int>(x + m_localPosition.x, MEMORY_SIZE);
-	y = ModulusNegative<int>(y + m_localPosition.y, MEMORY_SIZE);
+	PaletteEntry entry{ tile.m_backingTile, tile.m_renderChar, tile.m_color };
+	auto [it, added] = m_paletteLookup.try_emplace(entry, (ushort) m_palette.size());
+	if (added)
+	{
+		STRONG_ASSERT(m_palette.size() <= MAX_USHORT);
+		m_palette.push_back(entry);
+	}
 
-	return m_tiles[IndexIntoTilemap(x, y)];
+	MemoryCell cell;
+	cell.m_paletteIndex = it->second;
+	cell.m_temperature = (uchar) tile.m_temperature;
+	cell.m_fromBacking = tile.m_fromBacking;
+	return cell;
 }
 
-int TileMemory::IndexIntoTilemap(short x, short y)
+DataTile TileMemory::Decode(MemoryCell cell) const
 {
-	int bigX = x / INTERLEAVE_VALUE;
-	int lilX = x % INTERLEAVE_VALUE;
-	int bigY = y / INTERLEAVE_VALUE;
-	int lilY = y % INTERLEAVE_VALUE;
+	const PaletteEntry& entry = m_palette[cell.m_paletteIndex];
 
-	int bigValue = (bigX + bigY * (MEMORY_SIZE / (INTERLEAVE_VALUE))) * (INTERLEAVE_VALUE * INTERLEAVE_VALUE);
-	int lilValue = lilX + (lilY * INTERLEAVE_VALUE);
+	DataTile tile;
+	tile.m_backingTile = entry.m_backingTile;
+	tile.m_temperature = (ETemperature) cell.m_temperature;
+	tile.m_renderChar = entry.m_renderChar;
+	tile.m_color = entry.m_color;
+	tile.m_fromBacking = cell.m_fromBacking;
+	return tile;
+}
+
+bool TileMemory::IsUnchanged(MemoryCell cell, const Tile& tile) const
+{
+	return cell.m_fromBacking && !tile.m_stats.IsValid() && (m_palette[cell.m_paletteIndex].m_backingTile == tile.m_backingTile) && (cell.m_temperature == (uchar) TemperatureFromHeat(tile.m_heat));
+}
 
-	return bigValue + lilValue;
-	//return (x + (MEMORY_SIZE * y));
+void TileMemory::RebuildPaletteLookup()
+{
+	m_paletteLookup.clear();
+	for (size_t i = 0; i < m_palette.size(); i++)
+	{
+		m_paletteLookup[m_palette[i]] = (ushort) i;
+	}
 }
 
-void TileMemory::Debug_CheckIndexingDuplicates()
+bool TileMemory::IsValid() const
 {
-	std::unordered_map<int, Vec2> indicesMap;
-	for (int j = 0; j < MEMORY_SIZE; j++)
+	//Entry 0 is what unseen space decodes to, so it has to be there even with no pages
+	if (m_palette.empty())
 	{
-		for (int i = 0; i < MEMORY_SIZE; i++)
+		return false;
+	}
+
+	return std::all_of(m_pages.begin(), m_pages.end(), [&](const auto& pair) { return pair.second.IsValid(m_palette.size()); });
+}
+
+int TileMemory::GetNumPages() const
+{
+	return (int) m_pages.size();
+}
+
+int TileMemory::GetNumPaletteEntries() const
+{
+	return (int) m_palette.size();
+}
+
+int TileMemory::GetNumColdPages() const
+{
+	int count = 0;
+	for (const auto& [key, page] : m_pages)
+	{
+		count += page.IsCold();
+	}
+	return count;
+}
+
+size_t TileMemory::GetResidentBytes() const
+{
+	size_t bytes = sizeof(TileMemory) + (m_palette.capacity() * sizeof(PaletteEntry));
+	for (const auto& [key, page] : m_pages)
+	{
+		bytes += sizeof(key) + page.GetResidentBytes();
+	}
+	return bytes;
+}
+
+MemoryCell& TileMemory::GetCellByLocal(int x, int y)
+{
+	Vec2 position = m_localPosition + Vec2(x, y);
+	return GetPage(GetPagePosition(position)).m_cells[GetIndexInPage(position)];
+}
+
+MemoryPage& TileMemory::GetPage(Vec2 page)
+{
+	uint64_t key = GetPageKey(page);
+	auto [it, created] = m_pages.try_emplace(key);
+	MemoryPage& memoryPage = it->second;
+	if (created || memoryPage.IsCold())
+	{
+		memoryPage.Thaw();
+		m_hotPages.push_back(key);
+	}
+	return memoryPage;
+}
+
+const MemoryPage* TileMemory::FindPage(Vec2 page) const
+{
+	auto it = m_pages.find(GetPageKey(page));
+	return (it != m_pages.end()) ? &it->second : nullptr;
+}
+
+void TileMemory::FreezeDistantPages()
+{
+	ROGUE_PROFILE_SECTION("TileMemory::FreezeDistantPages");
+	Vec2 center = GetPagePosition(m_localPosition);
+	for (size_t i = 0; i < m_hotPages.size();)
+	{
+		uint64_t key = m_hotPages[i];
+		Vec2 position = Vec2((int) (key >> 32), (int) (key & MAX_UINT));
+		if (std::abs(position.x - center.x) > COLD_PAGE_RADIUS || std::abs(position.y - center.y) > COLD_PAGE_RADIUS)
 		{
-			int index = IndexIntoTilemap(i, j);
-
-			if (indicesMap.contains(index))
-			{
-				Vec2 match = indicesMap[index];
-				DEBUG_PRINT("Duplicate indices!! [%d, %d] and [%d, %d]", match.x, match.y, i, j);
-			}
-			else
-			{
-				indicesMap[index] = Vec2(i, j);
-			}
+			//Pages that don't compress stay hot, but drop out of the list either way - they're only
+			//looked at again if they're written to after going cold
+			m_pages[key].Freeze();
+			m_hotPages[i] = m_hotPages.back();
+			m_hotPages.pop_back();
+		}
+		else
+		{
+			i++;
 		}
 	}
 }
 
-void TileMemory::WipeLocalRect(Vec2 position, Vec2 size)
+void TileMemory::RebuildHotPages()
 {
-	for (int xOff = 0; xOff < size.x; xOff++)
+	m_hotPages.clear();
+	for (const auto& [key, page] : m_pages)
 	{
-		for (int yOff = 0; yOff < size.y; yOff++)
+		if (!page.IsCold())
 		{
-			int x = ModulusNegative<int>(position.x + xOff + m_localPosition.x, MEMORY_SIZE);
-			int y = ModulusNegative<int>(position.y + yOff + m_localPosition.y, MEMORY_SIZE);
-
-			m_tiles[IndexIntoTilemap(x, y)] = DataTile();
+			m_hotPages.push_back(key);
 		}
 	}
 }
 
-Vec2 TileMemory::WrapVector(Vec2 vector)
+uint64_t TileMemory::GetPageKey(Vec2 page)
 {
-	Vec2 outVector;
-	vector.x = ModulusNegative<short>(vector.x, MEMORY_SIZE);
-	vector.y = ModulusNegative<short>(vector.y, MEMORY_SIZE);
-	return outVector;
-}
\ No newline at end of file
+	return (uint64_t((uint) page.x) << 32) | uint64_t((uint) page.y);
+}
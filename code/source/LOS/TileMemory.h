@@ -2,10 +2,13 @@
 #include "Core/CoreDataTypes.h"
 #include "Core/Math/Math.h"
 #include "Map/Map.h"
+#include "LOS/LOS.h"
 #include "Core/Materials/Materials.h"
 #include "Data/Serialization/BitStream.h"
 #include "Data/Serialization/Serialization.h"
 #include <vector>
+#include <span>
+#include <unordered_map>
 
 class Tile;
 class Map;
@@ -34,23 +37,118 @@ struct DataTile
 	ETemperature m_temperature = ETemperature::Average;
 	char m_renderChar;
 	Color m_color;
+	bool m_fromBacking = false; //Built from a tile without instance data - backing tile and temperature are all it depends on. Never sent.
 
 	static DataTile FromTile(const Tile& tile);
 	bool operator==(const Tile& other);
+	bool operator==(const DataTile& other) const;
 };
 
-#define INTERLEAVE_TILES
-static constexpr uint INTERLEAVE_VALUE = 8;
-static constexpr uint MEMORY_RADIUS = 127;
-static constexpr uint MEMORY_SIZE = RoundUpNearestMultiple((2 * MEMORY_RADIUS) + 1, INTERLEAVE_VALUE);
-static constexpr uint MEMORY_BUFFER_SIZE = MEMORY_SIZE * MEMORY_SIZE;
+ETemperature TemperatureFromHeat(float heat);
 
+//One look a remembered tile can have. Memory keeps a palette of these, and cells only store an index into it.
+struct PaletteEntry
+{
+	THandle<BackingTile> m_backingTile;
+	char m_renderChar = 0;
+	Color m_color;
+
+	bool operator==(const PaletteEntry& other) const;
+};
+
+struct PaletteEntryHash
+{
+	size_t operator()(const PaletteEntry& entry) const;
+};
+
+//A remembered tile as it's stored - a palette index plus the temperature, which changes too often to palette
+struct MemoryCell
+{
+	ushort m_paletteIndex = 0;
+	uchar m_temperature : 4 = (uchar) ETemperature::Average;
+	uchar m_fromBacking : 1 = false; //See DataTile::m_fromBacking
+
+	//Same look - ignores m_fromBacking, which is bookkeeping and never sent
+	bool SameLook(const MemoryCell& other) const { return m_paletteIndex == other.m_paletteIndex && m_temperature == other.m_temperature; }
+	bool operator==(const MemoryCell& other) const { return SameLook(other) && m_fromBacking == other.m_fromBacking; }
+
+	uint GetPacked() const { return m_paletteIndex | (uint(m_temperature) << 16) | (uint(m_fromBacking) << 20); }
+	void SetPacked(uint packed);
+};
+
+static_assert(sizeof(MemoryCell) == 4);
+
+static constexpr uint INTERLEAVE_SHIFT = 3;
+static constexpr uint INTERLEAVE_VALUE = 1 << INTERLEAVE_SHIFT; //Tiles along each side of a memory page
+static constexpr uint INTERLEAVE_MASK = INTERLEAVE_VALUE - 1;
+static constexpr uint PAGE_TILES = INTERLEAVE_VALUE * INTERLEAVE_VALUE;
+static constexpr uint MEMORY_RADIUS = 127; //Pages further than this from the player get compressed
+static constexpr int COLD_PAGE_RADIUS = (MEMORY_RADIUS / INTERLEAVE_VALUE) + 1;
+
+//Pages are the same size as world chunks, but are keyed by memory-space position - once the player has walked
+//through a portal, a page can hold tiles from several chunks and doesn't line up with any of them
+static_assert(INTERLEAVE_VALUE == CHUNK_SIZE_X && INTERLEAVE_VALUE == CHUNK_SIZE_Y);
+
+//Z-order index inside a page - the low bits of x and y interleaved, so 2x2 and 4x4 blocks stay next to each other.
+//Only looks at the bits inside the page, so any memory position can be passed in directly.
+constexpr int MortonIndex(int x, int y)
+{
+	static_assert(INTERLEAVE_SHIFT == 3, "Bit spread below only covers three bits");
+	uint spreadX = x & INTERLEAVE_MASK;
+	spreadX = (spreadX | (spreadX << 2)) & 0x13;
+	spreadX = (spreadX | (spreadX << 1)) & 0x15;
+
+	uint spreadY = y & INTERLEAVE_MASK;
+	spreadY = (spreadY | (spreadY << 2)) & 0x13;
+	spreadY = (spreadY | (spreadY << 1)) & 0x15;
+
+	return (int) (spreadX | (spreadY << 1));
+}
+
+static_assert(MortonIndex(1, 0) == 1 && MortonIndex(0, 1) == 2 && MortonIndex(2, 0) == 4 && MortonIndex(7, 7) == PAGE_TILES - 1);
+static_assert(MortonIndex(-1, -8) == MortonIndex(7, 0));
+
+//One square page of remembered tiles. Hot pages hold every cell, cold pages only hold runs of
+//identical cells - explored ground is mostly the same few tiles, so they shrink a lot.
+struct MemoryPage
+{
+	struct TileRun
+	{
+		uchar m_count;
+		MemoryCell m_cell;
+	};
+
+	vector<MemoryCell> m_cells;
+	vector<TileRun> m_runs;
+
+	MemoryPage();
+
+	bool IsCold() const { return m_cells.empty(); }
+	MemoryCell GetCell(int index) const;
+	void Expand(std::span<MemoryCell, PAGE_TILES> cells) const;
+	bool Freeze(); //False if the page wouldn't get any smaller, and stays hot
+	void Thaw();
+	size_t GetResidentBytes() const;
+
+	//Covers exactly one page of cells, all pointing inside a palette of this size
+	bool IsValid(size_t paletteSize) const;
+};
+
+//Everything the player has seen, in memory space - world space as the player has walked it, so portals
+//line up the way they look. Pages are allocated the first time a tile in them is written.
+//Tiles go in and out as DataTiles, but are stored as cells pointing into a palette of looks.
 class TileMemory
 {
 public:
 	TileMemory();
 
-	void Update(View& los);
+	void Update(const View& los);
+
+	//Bulk update from the cells a cast revealed, skipping the rebuild for tiles that can't have changed.
+	//Calls onCell(cell, oldTile, newTile, changed) for each one, in order, before memory is overwritten.
+	template<typename Function>
+	void Update(const View& los, Function&& onCell);
+
 	void Wipe();
 	void Move(Vec2 offset);
 
@@ -58,21 +156,139 @@ public:
 	void SetTileByLocal(int x, int y, Location location);
 	void SetTileByLocal(int x, int y, const Tile& tile);
 	void SetTileByLocal(int x, int y, const DataTile& tile);
-	bool ValidTile(int x, int y);
-	DataTile& GetTileByLocal(int x, int y);
-	int IndexIntoTilemap(short x, short y);
+	bool ValidTile(int x, int y) const;
+
+	DataTile GetTileByLocal(int x, int y) const;
+
+	//Walks a rect of local positions a page at a time, calling function(x, y, tile) - pages go in row order, and
+	//tiles go in row order inside each page, not in Morton order. Cold pages are expanded once instead of per tile,
+	//and unseen space gives an empty tile.
+	template<typename Function>
+	void ForEachInRect(Vec2 min, Vec2 size, Function&& function) const;
 
-	vector<DataTile> m_tiles;
-	vector<Location> m_realLocations;
+	template<typename Function>
+	void ForEachInRow(Vec2 start, int length, Function&& function) const { ForEachInRect(start, Vec2(length, 1), function); }
+
+	MemoryCell Encode(const DataTile& tile);
+	DataTile Decode(MemoryCell cell) const;
+
+	//Cheap check that rebuilding this cell from the tile would give the same result, without touching materials
+	bool IsUnchanged(MemoryCell cell, const Tile& tile) const;
+
+	//Every page is whole and every cell has a palette entry. Only needed for memory that came from outside.
+	bool IsValid() const;
+
+	int GetNumPages() const;
+	int GetNumPaletteEntries() const;
+	int GetNumColdPages() const;
+	size_t GetResidentBytes() const;
+
+	unordered_map<uint64_t, MemoryPage> m_pages;
+	vector<PaletteEntry> m_palette; //Entry 0 is always the empty tile
 	Vec2 m_localPosition;
 
+	void RebuildPaletteLookup();
+	void RebuildHotPages();
+
 private:
-	void Debug_CheckIndexingDuplicates();
-	void WipeLocalRect(Vec2 position, Vec2 size);
+	//Pages the cell in (and thaws its page), so only use it to write
+	MemoryCell& GetCellByLocal(int x, int y);
+	MemoryPage& GetPage(Vec2 page);
+	const MemoryPage* FindPage(Vec2 page) const;
+	void FreezeDistantPages();
+
+	static uint64_t GetPageKey(Vec2 page);
 
-	static Vec2 WrapVector(Vec2 vector);
+	//Arithmetic shift, so negative positions round down into the right page
+	static Vec2 GetPagePosition(Vec2 position) { return Vec2(position.x >> INTERLEAVE_SHIFT, position.y >> INTERLEAVE_SHIFT); }
+	static int GetIndexInPage(Vec2 position) { return MortonIndex(position.x, position.y); }
+
+	unordered_map<PaletteEntry, ushort, PaletteEntryHash> m_paletteLookup;
+	vector<uint64_t> m_hotPages; //Keys of pages that were hot when last written, so freezing only looks near the player
+	vector<View::RevealedCell> m_revealed; //Scratch for Update, refilled from the view each call
 };
 
+template<typename Function>
+void TileMemory::Update(const View& los, Function&& onCell)
+{
+	ROGUE_PROFILE_SECTION("TileMemory::Update");
+
+	//Revealed cells come in row order, so most lookups land in the same page as the last one
+	Vec2 lastPage;
+	MemoryPage* page = nullptr;
+	los.GetRevealed(m_revealed);
+	for (const View::RevealedCell& cell : m_revealed)
+	{
+		Vec2 position = m_localPosition + Vec2(cell.m_x, cell.m_y);
+		Vec2 pagePosition = GetPagePosition(position);
+		if (page == nullptr || pagePosition != lastPage)
+		{
+			page = &GetPage(pagePosition);
+			lastPage = pagePosition;
+		}
+
+		MemoryCell& memory = page->m_cells[GetIndexInPage(position)];
+		const Tile& tile = cell.m_location.GetTile();
+		DataTile old = Decode(memory);
+		if (IsUnchanged(memory, tile))
+		{
+			onCell(cell, old, old, false);
+			continue;
+		}
+
+		DataTile fresh = DataTile::FromTile(tile);
+		MemoryCell freshCell = Encode(fresh);
+		onCell(cell, old, fresh, !freshCell.SameLook(memory));
+		memory = freshCell;
+	}
+}
+
+template<typename Function>
+void TileMemory::ForEachInRect(Vec2 min, Vec2 size, Function&& function) const
+{
+	if (size.x <= 0 || size.y <= 0) { return; }
+
+	constexpr int pageSize = INTERLEAVE_VALUE;
+	Vec2 start = m_localPosition + min;
+	Vec2 end = start + size;
+	Vec2 firstPage = GetPagePosition(start);
+	Vec2 lastPage = GetPagePosition(end - Vec2(1, 1));
+
+	const DataTile empty = Decode(MemoryCell());
+	MemoryCell expanded[PAGE_TILES];
+	for (int pageY = firstPage.y; pageY <= lastPage.y; pageY++)
+	{
+		for (int pageX = firstPage.x; pageX <= lastPage.x; pageX++)
+		{
+			const MemoryCell* cells = nullptr;
+			if (const MemoryPage* page = FindPage(Vec2(pageX, pageY)))
+			{
+				if (page->IsCold())
+				{
+					page->Expand(expanded);
+					cells = expanded;
+				}
+				else
+				{
+					cells = page->m_cells.data();
+				}
+			}
+
+			int minX = std::max(start.x, pageX * pageSize);
+			int maxX = std::min(end.x, (pageX + 1) * pageSize);
+			int minY = std::max(start.y, pageY * pageSize);
+			int maxY = std::min(end.y, (pageY + 1) * pageSize);
+			for (int y = minY; y < maxY; y++)
+			{
+				for (int x = minX; x < maxX; x++)
+				{
+					function(x - m_localPosition.x, y - m_localPosition.y, cells ? Decode(cells[MortonIndex(x, y)]) : empty);
+				}
+			}
+		}
+	}
+}
+
 namespace Serialization
 {
 	template<>
@@ -100,6 +316,82 @@ namespace Serialization
 		}
 	};
 
+	template<>
+	struct Serializer<PaletteEntry> : ObjectSerializer<PaletteEntry>
+	{
+		template<typename Stream>
+		static void Serialize(Stream& stream, const PaletteEntry& value)
+		{
+			Write(stream, "Backing Tile", value.m_backingTile);
+			Write(stream, "Render Char", value.m_renderChar);
+			Write(stream, "Visible Color", value.m_color);
+		}
+
+		template<typename Stream>
+		static void Deserialize(Stream& stream, PaletteEntry& value)
+		{
+			Read(stream, "Backing Tile", value.m_backingTile);
+			Read(stream, "Render Char", value.m_renderChar);
+			Read(stream, "Visible Color", value.m_color);
+		}
+	};
+
+	template<>
+	struct Serializer<MemoryCell> : ObjectSerializer<MemoryCell>
+	{
+		template<typename Stream>
+		static void Serialize(Stream& stream, const MemoryCell& value)
+		{
+			Write(stream, "Packed", value.GetPacked());
+		}
+
+		template<typename Stream>
+		static void Deserialize(Stream& stream, MemoryCell& value)
+		{
+			value.SetPacked(Read<Stream, uint>(stream, "Packed"));
+		}
+	};
+
+	template<>
+	struct Serializer<MemoryPage::TileRun> : ObjectSerializer<MemoryPage::TileRun>
+	{
+		template<typename Stream>
+		static void Serialize(Stream& stream, const MemoryPage::TileRun& value)
+		{
+			Write(stream, "Count", value.m_count);
+			Write(stream, "Cell", value.m_cell);
+		}
+
+		template<typename Stream>
+		static void Deserialize(Stream& stream, MemoryPage::TileRun& value)
+		{
+			Read(stream, "Count", value.m_count);
+			Read(stream, "Cell", value.m_cell);
+		}
+	};
+
+	//Cold pages stay compressed on disk too
+	template<>
+	struct Serializer<MemoryPage> : ObjectSerializer<MemoryPage>
+	{
+		template<typename Stream>
+		static void Serialize(Stream& stream, const MemoryPage& value)
+		{
+			Write(stream, "Cells", value.m_cells);
+			Write(stream, "Runs", value.m_runs);
+		}
+
+		template<typename Stream>
+		static void Deserialize(Stream& stream, MemoryPage& value)
+		{
+			value.m_cells.clear();
+			value.m_runs.clear();
+			Read(stream, "Cells", value.m_cells);
+			Read(stream, "Runs", value.m_runs);
+		}
+	};
+
+	//Saved as part of player data - changing this layout needs a new save version (see RogueSaveManager::version)
 	template<>
 	struct Serializer<TileMemory> : ObjectSerializer<TileMemory>
 	{
@@ -107,14 +399,19 @@ namespace Serialization
 		static void Serialize(Stream& stream, const TileMemory& value)
 		{
 			Write(stream, "Local Position", value.m_localPosition);
-			Write(stream, "Tile Memory", value.m_tiles);
+			Write(stream, "Palette", value.m_palette);
+			Write(stream, "Pages", value.m_pages);
 		}
 
 		template<typename Stream>
 		static void Deserialize(Stream& stream, TileMemory& value)
 		{
+			value.m_pages.clear();
 			Read(stream, "Local Position", value.m_localPosition);
-			Read(stream, "Tile Memory", value.m_tiles);
+			Read(stream, "Palette", value.m_palette);
+			Read(stream, "Pages", value.m_pages);
+			value.RebuildPaletteLookup();
+			value.RebuildHotPages();
 		}
 	};
 }
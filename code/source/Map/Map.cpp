@@ -2,6 +2,7 @@
 #include "Game/Game.h"
 #include "Data/JobSystem.h"
 #include "Core/Collections/StackArray.h"
+#include <atomic>
 
 bool Tile::operator==(const Tile& other)
 {
@@ -80,17 +81,24 @@ Tile& Chunk::GetTile(Vec4 location)
     return m_tiles[GetIndex(location)];
 }
 
+const Tile& Chunk::GetTile(Vec4 location) const
+{
+    return m_tiles[GetIndex(location)];
+}
+
 void Chunk::SetTile(Vec4 location, THandle<BackingTile> tile)
 {
     Tile& mapTile = m_tiles[GetIndex(location)];
     mapTile.m_backingTile = tile;
     mapTile.m_wall = mapTile.GetVisibleMaterial().second;
+    MarkVisionDirty(location);
 }
 
 void Chunk::SetTile(Vec4 location, const Tile& tile)
 {
     Tile& mapTile = m_tiles[GetIndex(location)];
     mapTile = tile;
+    MarkVisionDirty(location);
 }
 
 Vec4 Chunk::GetChunkCorner() const
@@ -192,7 +200,12 @@ bool Chunk::ApplyHeatDeltas(vector<float>& scratch)
 
 						if (Game::materialManager->EvaluateReaction(tile.m_stats->m_floorMaterials, tile.m_stats->m_volumeMaterials, tile.m_heat))
 						{
-							tile.m_wall = tile.GetVisibleMaterial().second;
+							bool wall = tile.GetVisibleMaterial().second;
+							if (wall != tile.m_wall)
+							{
+								tile.m_wall = wall;
+								MarkVisionDirty(localLocation);
+							}
 							tile.m_dirty = true;
 							anyUpdates = true;
 						}
@@ -210,7 +223,48 @@ void Chunk::MarkDirty()
     m_dirty = true;
 }
 
-int Chunk::GetIndex(const Vec4& location)
+void Chunk::MarkVisionDirty(Vec4 location)
+{
+    int index = GetIndex(location);
+    const Tile& tile = m_tiles[index];
+    uint64_t bit = uint64_t(1) << index;
+
+    m_wallMask = tile.m_wall ? (m_wallMask | bit) : (m_wallMask & ~bit);
+    bool portal = tile.UsingInstanceData() && tile.m_stats->m_neighbors.IsValid();
+    m_portalMask = portal ? (m_portalMask | bit) : (m_portalMask & ~bit);
+
+    m_visionGeneration = NextVisionGeneration();
+}
+
+void Chunk::RebuildVisionMasks()
+{
+    m_wallMask = 0;
+    m_portalMask = 0;
+    for (size_t index = 0; index < m_tiles.size(); index++)
+    {
+        const Tile& tile = m_tiles[index];
+        uint64_t bit = uint64_t(1) << index;
+        if (tile.m_wall)
+        {
+            m_wallMask |= bit;
+        }
+        if (tile.UsingInstanceData() && tile.m_stats->m_neighbors.IsValid())
+        {
+            m_portalMask |= bit;
+        }
+    }
+
+    m_visionGeneration = NextVisionGeneration();
+}
+
+uint64_t Chunk::NextVisionGeneration()
+{
+    //Starts at 1 - 0 is ChunkMap::InvalidVisionGeneration
+    static std::atomic<uint64_t> nextGeneration = 1;
+    return nextGeneration.fetch_add(1, std::memory_order_relaxed);
+}
+
+int Chunk::GetIndex(const Vec4& location) const
 {
     ASSERT(location.x >= 0 && location.x < CHUNK_SIZE_X&& location.y >= 0 && location.y < CHUNK_SIZE_Y && location.z >= 0 && location.z < CHUNK_SIZE_Z && location.w >= 0 && location.w < CHUNK_SIZE_W);
     int index = location.x + CHUNK_SIZE_X * location.y + CHUNK_SIZE_X * CHUNK_SIZE_Y * location.z + CHUNK_SIZE_X * CHUNK_SIZE_Y * CHUNK_SIZE_Z * location.w;
@@ -260,11 +314,22 @@ void ChunkMap::WaitForStreaming()
     }
 }
 
+ChunkMap::ChunkMap(const ChunkMap& other) :
+    m_chunks(other.m_chunks),
+    m_backingTiles(other.m_backingTiles)
+{
+}
+
 Tile& ChunkMap::GetTile(Location location)
 {
     return GetChunk(location.GetChunkPosition())->GetTile(location.GetChunkLocalPosition());
 }
 
+const Tile& ChunkMap::GetTileForRead(Location location)
+{
+    return GetChunkForRead(location.GetChunkPosition())->GetTile(location.GetChunkLocalPosition());
+}
+
 void ChunkMap::AsyncAddChunk(Vec4 chunkLoc, Chunk* chunk)
 {
     m_mapMutex.lock();
@@ -385,6 +450,51 @@ void ChunkMap::Simulate(Location location, Vec4 radius)
     }
 }
 
+void ChunkMap::MarkVisionDirty(Location location)
+{
+    GetChunk(location.GetChunkPosition())->MarkVisionDirty(location.GetChunkLocalPosition());
+}
+
+VisionTile ChunkMap::GetVisionTile(Location location)
+{
+    if (!location.GetValid())
+    {
+        return VisionTile();
+    }
+
+    return GetChunkForRead(location.GetChunkPosition())->GetVisionTile(location.GetChunkLocalPosition());
+}
+
+bool ChunkMap::TryGetVisionTile(Location location, VisionTile& outTile) const
+{
+    if (!location.GetValid())
+    {
+        outTile = VisionTile();
+        return true;
+    }
+
+    auto it = m_chunks.find(location.GetChunkPosition());
+    if (it == m_chunks.end())
+    {
+        outTile = VisionTile();
+        return false;
+    }
+
+    outTile = it->second->GetVisionTile(location.GetChunkLocalPosition());
+    return true;
+}
+
+uint64_t ChunkMap::GetVisionGeneration(Vec4 chunkId) const
+{
+    auto it = m_chunks.find(chunkId);
+    if (it == m_chunks.end())
+    {
+        return InvalidVisionGeneration;
+    }
+
+    return it->second->GetVisionGeneration();
+}
+
 void ChunkMap::AddHeat(Location location, float heat)
 {
     Tile& tile = GetTile(location);
@@ -403,18 +513,47 @@ void ChunkMap::AddHeat(Location location, float heat)
 
 Chunk* ChunkMap::GetChunk(Vec4 chunkId)
 {
-    if (!m_chunks.contains(chunkId))
+    std::shared_ptr<Chunk>& chunk = WaitForChunk(chunkId);
+
+    //A save snapshot still holds it - give it our own copy, and leave the old one to the save. Snapshots only
+    //ever let go of their chunks, so once we're the only owner we stay that way until the next snapshot.
+    if (chunk.use_count() > 1)
+    {
+        ROGUE_PROFILE_SECTION("ChunkMap::CopyOnWrite");
+        //Swaps the pointer other threads may be reading through - only the game thread has a Game
+        ASSERT(GetGame() != nullptr);
+        chunk = std::make_shared<Chunk>(*chunk);
+    }
+    else
+    {
+        //Pairs with the snapshot's release, so its last reads of the chunk happen before we write to it
+        std::atomic_thread_fence(std::memory_order_acquire);
+    }
+
+    return chunk.get();
+}
+
+const Chunk* ChunkMap::GetChunkForRead(Vec4 chunkId)
+{
+    return WaitForChunk(chunkId).get();
+}
+
+std::shared_ptr<Chunk>& ChunkMap::WaitForChunk(Vec4 chunkId)
+{
+    auto it = m_chunks.find(chunkId);
+    if (it == m_chunks.end())
     {
         //We need it! Enqueue it and wait. Stream with a small radius (we probably want it too)
+        //Inserts into m_chunks, so it can't happen on a job worker
+        ASSERT(GetGame() != nullptr);
         StreamChunk(chunkId, Vec4(1, 1, 0, 0));
-        while (!m_chunks.contains(chunkId))
+        while ((it = m_chunks.find(chunkId)) == m_chunks.end())
         {
             MainThread_InsertReadyChunks();
         }
     }
 
-    ASSERT(m_chunks.contains(chunkId));
-    return m_chunks[chunkId];
+    return it->second;
 }
 
 void ChunkMap::StreamChunk(Vec4 chunkId, Vec4 radius)
@@ -464,7 +603,7 @@ void ChunkMap::MainThread_InsertReadyChunks()
     {
         const Vec4& chunk = iterator.first;
         //DEBUG_PRINT("Finished: [%d, %d, %d]", chunk.x, chunk.y, chunk.z);
-        m_chunks[chunk] = iterator.second;
+        m_chunks[chunk] = std::shared_ptr<Chunk>(iterator.second);
         m_loadingChunks.erase(chunk);
     }
 
@@ -6,6 +6,7 @@
 #include <type_traits>
 #include <unordered_map>
 #include <set>
+#include <memory>
 
 class BackingTile;
 class TileStats;
@@ -101,6 +102,7 @@ public:
     Chunk() {}
     Chunk(Vec4 chunkLocation);
     Tile& GetTile(Vec4 location);
+    const Tile& GetTile(Vec4 location) const;
     void SetTile(Vec4 location, THandle<BackingTile> tile);
     void SetTile(Vec4 location, const Tile& tile);
 
@@ -114,14 +116,32 @@ public:
     void MarkDirty();
     void ClearDirty() { m_dirty = false; }
 
+    //Vision generation - changes whenever something LOS reads (walls, portals) changes in this chunk.
+    //Drawn from one global counter, so a regenerated or reloaded chunk never matches an old stamp.
+    uint64_t GetVisionGeneration() const { return m_visionGeneration; }
+    void MarkVisionDirty(Vec4 location);
+    void RebuildVisionMasks();
+    static uint64_t NextVisionGeneration();
+
+    VisionTile GetVisionTile(Vec4 location) const
+    {
+        uint64_t bit = uint64_t(1) << GetIndex(location);
+        return { true, (m_wallMask & bit) != 0, (m_portalMask & bit) != 0 };
+    }
 
 private:
-    int GetIndex(const Vec4& location);
+    int GetIndex(const Vec4& location) const;
 
     Vec4 m_chunkLocation;
     vector<Tile> m_tiles;
     float m_defaultHeat = 0;
     bool m_dirty = false;
+    uint64_t m_visionGeneration = NextVisionGeneration();
+
+    //One bit per tile, by GetIndex - mirrors m_wall, and whether the tile has neighbor data
+    static_assert(CHUNK_SIZE_X * CHUNK_SIZE_Y * CHUNK_SIZE_Z * CHUNK_SIZE_W <= 64, "Vision masks need a bit per tile");
+    uint64_t m_wallMask = 0;
+    uint64_t m_portalMask = 0;
 
     friend struct Serialization::Serializer<Chunk>;
 };
@@ -129,9 +149,16 @@ private:
 class ChunkMap
 {
 public:
+    ChunkMap() {}
+    //Snapshot copy for saving - shares every loaded chunk with the original until the original writes to it
+    //(see GetChunk), so it's cheap to take. Chunks that are still streaming in stay with the original.
+    ChunkMap(const ChunkMap& other);
+
     void TriggerStreamingAroundLocation(Location loc, Vec4 radius = Vec4(LOAD_CHUNK_RADIUS, LOAD_CHUNK_RADIUS, 0, 0));
     void WaitForStreaming();
     Tile& GetTile(Location location);
+    //Never copies a chunk away from a snapshot, so job workers can use it on chunks that are already loaded
+    const Tile& GetTileForRead(Location location);
     void AsyncAddChunk(Vec4 chunkLoc, Chunk* chunk);
 
     int LinkBackingTile(THandle<BackingTile> tile);
@@ -150,13 +177,25 @@ public:
 
     void AddHeat(Location location, float heat);
 
+    //Vision generations by chunk. Never streams - chunks that aren't loaded report InvalidVisionGeneration.
+    static constexpr uint64_t InvalidVisionGeneration = 0;
+    void MarkVisionDirty(Location location);
+    uint64_t GetVisionGeneration(Vec4 chunkId) const;
+
+    VisionTile GetVisionTile(Location location);
+    //Read-only lookup for job workers - never streams, returns false if the chunk isn't loaded yet
+    bool TryGetVisionTile(Location location, VisionTile& outTile) const;
+
 private:
+    //Streams the chunk in if it isn't loaded. Writable, so a chunk still shared with a snapshot gets copied first.
     Chunk* GetChunk(Vec4 chunkId);
+    const Chunk* GetChunkForRead(Vec4 chunkId);
+    std::shared_ptr<Chunk>& WaitForChunk(Vec4 chunkId);
     void StreamChunk(Vec4 chunkId, Vec4 radius);
     void MainThread_InsertReadyChunks();
 
     ROGUE_LOCK(std::mutex, m_mapMutex);
-    unordered_map<Vec4, Chunk*> m_chunks;
+    unordered_map<Vec4, std::shared_ptr<Chunk>> m_chunks;
     unordered_map<Vec4, Chunk*> m_readyChunks;
     set<Vec4> m_loadingChunks;
     vector<THandle<BackingTile>> m_backingTiles;
@@ -226,6 +265,7 @@ namespace Serialization
     	    Read(stream, "Tiles", value.m_tiles);
     	    Read(stream, "Default Heat", value.m_defaultHeat);
     	    Read(stream, "Dirty", value.m_dirty);
+    	    value.RebuildVisionMasks();
     	}
     };
 
@@ -238,7 +278,7 @@ namespace Serialization
     	    uint32_t chunkCount = value.m_chunks.size();
     	    Write(stream, "Chunk Count", chunkCount);
 
-    	    for (auto it : value.m_chunks)
+    	    for (const auto& it : value.m_chunks)
     	    {
     	        Write(stream, "Location", it.first);
     	        Write(stream, "Chunk", *it.second);
@@ -256,11 +296,11 @@ namespace Serialization
     	    for (uint count = 0; count < chunkCount; count++)
     	    {
     	        Vec4 location;
-    	        Chunk* chunk = new Chunk();
+    	        std::shared_ptr<Chunk> chunk = std::make_shared<Chunk>();
     	        Read(stream, "Location", location);
     	        Read(stream, "Chunk", *chunk);
 
-    	        value.m_chunks[location] = chunk;
+    	        value.m_chunks[location] = std::move(chunk);
     	    }
 
     	    Read(stream, "Backing Tiles", value.m_backingTiles);
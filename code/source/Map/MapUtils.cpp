@@ -57,5 +57,6 @@ namespace MapUtils
 
 		location->m_wall = false;
 		location->m_dirty = true;
+		GetDataManager()->ResolveByTypeIndex<ChunkMap>(0)->MarkVisionDirty(location);
 	}
 }
@@ -27,6 +27,7 @@
 #include "Render/Fonts/FontManager.h"
 #include "Render/Terminal.h"
 #include "Game/Game.h"
+#include "Game/IPC.h"
 #include "Utils/Utils.h"
 
 #include "Data/Serialization/BitStream.h"
@@ -56,38 +57,27 @@ void Render_Player_Data(PlayerData& data, Window* window, Location playerLocatio
     View& view = data.GetCurrentView();
     TileMemory& memory = data.GetCurrentMemory();
 
-    for (int i = 0; i < window->m_rect.w; i++)
-    {
-        for (int j = 0; j < window->m_rect.h; j++)
+    //Window row 0 is the top, so local y runs from h / 2 down
+    Vec2 bottomLeft = Vec2(-window->m_rect.w / 2, window->m_rect.h / 2 - window->m_rect.h + 1);
+    memory.ForEachInRect(bottomLeft, Vec2(window->m_rect.w, window->m_rect.h), [&](int localX, int localY, const DataTile& dataTile)
         {
-            int localX = i - window->m_rect.w / 2;
-            int localY = -j + window->m_rect.h / 2;
-
-            if (memory.ValidTile(localX, localY))
-            {
-                DataTile& dataTile = data.GetTileForLocal(localX, localY);
-                BackingTile& tile = data.GetBackingTileForLocal(localX, localY);
+            int i = localX + window->m_rect.w / 2;
+            int j = window->m_rect.h / 2 - localY;
 
-                bool visible = (std::abs(localX) <= view.GetRadius() && std::abs(localY) <= view.GetRadius() && view.GetVisibilityLocal(localX, localY));
+            bool visible = (std::abs(localX) <= view.GetRadius() && std::abs(localY) <= view.GetRadius() && view.GetVisibilityLocal(localX, localY));
 
-                if (visible)
-                {
-                    window->Put(i, j, dataTile.m_renderChar, dataTile.m_color, dataTile.m_color);
-                }
-                else
-                {
-                    Color greyish = Color(10, 10, 10);
-                    Color fgBlend = Blend(dataTile.m_color, greyish, 0.5f);
-                    Color bgBlend = Blend(dataTile.m_color, greyish, 0.5f);
-                    window->Put(i, j, dataTile.m_renderChar, fgBlend, bgBlend);
-                }
+            if (visible)
+            {
+                window->Put(i, j, dataTile.m_renderChar, dataTile.m_color, dataTile.m_color);
             }
             else
             {
-                window->Put(i, j, '2', Color(255, 0, 0), Color(0, 0, 0));
+                Color greyish = Color(10, 10, 10);
+                Color fgBlend = Blend(dataTile.m_color, greyish, 0.5f);
+                Color bgBlend = Blend(dataTile.m_color, greyish, 0.5f);
+                window->Put(i, j, dataTile.m_renderChar, fgBlend, bgBlend);
             }
-        }
-    }
+        });
 
     //Temp! Render character character
     window->Put(window->m_rect.w / 2, window->m_rect.h / 2, '@', Color(0,0,0), Color(255,255,255));
@@ -108,7 +98,7 @@ void Render_Path(PlayerData& data, Window* window)
 
         if (memory.ValidTile(localX, localY))
         {
-            DataTile& dataTile = data.GetTileForLocal(localX, localY);
+            const DataTile& dataTile = data.GetTileForLocal(localX, localY);
             BackingTile& tile = data.GetBackingTileForLocal(localX, localY);
             window->Put(windowX, windowY, dataTile.m_renderChar, Color(255, 255, 255), Color(255, 255, 255));
         }
@@ -122,40 +112,28 @@ void Render_Temperature(PlayerData& data, Window* window, Location playerLocatio
     View& view = data.GetCurrentView();
     TileMemory& memory = data.GetCurrentMemory();
 
-    for (int i = 0; i < window->m_rect.w; i++)
-    {
-        for (int j = 0; j < window->m_rect.h; j++)
+    Vec2 bottomLeft = Vec2(-window->m_rect.w / 2, window->m_rect.h / 2 - window->m_rect.h + 1);
+    memory.ForEachInRect(bottomLeft, Vec2(window->m_rect.w, window->m_rect.h), [&](int localX, int localY, const DataTile& tile)
         {
-            int localX = i - window->m_rect.w / 2;
-            int localY = -j + window->m_rect.h / 2;
-
-            if (memory.ValidTile(localX, localY))
-            {
-                DataTile& tile = data.GetTileForLocal(localX, localY);
-                BackingTile& backing = data.GetBackingTileForLocal(localX, localY);
+            int i = localX + window->m_rect.w / 2;
+            int j = window->m_rect.h / 2 - localY;
 
-                bool visible = (std::abs(localX) <= view.GetRadius() && std::abs(localY) <= view.GetRadius() && view.GetVisibilityLocal(localX, localY));
+            bool visible = (std::abs(localX) <= view.GetRadius() && std::abs(localY) <= view.GetRadius() && view.GetVisibilityLocal(localX, localY));
 
-                Color cold = Color(0, 0, 70);
-                Color hot = Color(255, 0, 0);
-                Color fgBlend = tile.m_color;
-                Color bgBlend = Blend(cold, hot, std::clamp(((float)tile.m_temperature / 4.0f), 0.0f, 1.0f));
+            Color cold = Color(0, 0, 70);
+            Color hot = Color(255, 0, 0);
+            Color fgBlend = tile.m_color;
+            Color bgBlend = Blend(cold, hot, std::clamp(((float)tile.m_temperature / 4.0f), 0.0f, 1.0f));
 
-                if (visible)
-                {
-                    window->Put(i, j, tile.m_renderChar, bgBlend, bgBlend);
-                }
-                else
-                {
-                    window->Put(i, j, tile.m_renderChar, Blend(bgBlend, Color(50, 50, 50), .8f), bgBlend);
-                }
+            if (visible)
+            {
+                window->Put(i, j, tile.m_renderChar, bgBlend, bgBlend);
             }
             else
             {
-                window->Put(i, j, '2', Color(255, 0, 0), Color(0, 0, 0));
+                window->Put(i, j, tile.m_renderChar, Blend(bgBlend, Color(50, 50, 50), .8f), bgBlend);
             }
-        }
-    }
+        });
 
     //Temp! Render character character
     window->Put(window->m_rect.w / 2, window->m_rect.h / 2, '@', Color(0, 0, 0), Color(255, 255, 255));
@@ -326,26 +304,69 @@ int main(int argc, char* argv[])
 
     uint numJobThreads = maxThreads;
 
+    //--server [path] runs just the simulation, behind a socket. --connect [path] plays a game that a server is running.
+    bool serverMode = false;
+    bool remoteMode = false;
+    std::string socketPath = IPC::DefaultSocketPath;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--server" || arg == "--connect")
+        {
+            serverMode = (arg == "--server");
+            remoteMode = (arg == "--connect");
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+            {
+                socketPath = argv[++i];
+            }
+        }
+    }
+
     Jobs::Initialize(numJobThreads);
     SetupResources();
 
     //Initialize Random
     srand(1);
 
-    Game game = Game();
-    std::thread gameThread(&Game::LaunchGame, &game);
-    bool gameReady = false;
-    EDrawState drawState = EDrawState::Normal;
+    if (serverMode)
+    {
+        IPC::GameServer server(socketPath);
+        bool ran = server.Run("TestSave.rsf", 420);
+        Resources::Shutdown();
+        Jobs::Shutdown();
+        return ran ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
 
-    if (RogueSaveManager::FileExists("TestSave.rsf"))
+    Game localGame = Game();
+    IPC::RemoteGame remoteGame;
+    std::thread gameThread;
+    if (remoteMode)
     {
-        game.CreateInput<LoadSaveGame>("TestSave.rsf");
+        if (!remoteGame.Connect(socketPath))
+        {
+            PRINT_ERR("No game server at %s", socketPath.c_str());
+            Resources::Shutdown();
+            Jobs::Shutdown();
+            return EXIT_FAILURE;
+        }
     }
     else
     {
-        game.CreateInput<BeginSeededGame>(420);
+        gameThread = std::thread(&Game::LaunchGame, &localGame);
+        if (RogueSaveManager::FileExists("TestSave.rsf"))
+        {
+            localGame.CreateInput<LoadSaveGame>("TestSave.rsf");
+        }
+        else
+        {
+            localGame.CreateInput<BeginSeededGame>(420);
+        }
     }
 
+    GameConnection& game = remoteMode ? (GameConnection&) remoteGame : (GameConnection&) localGame;
+    bool gameReady = false;
+    EDrawState drawState = EDrawState::Normal;
+
     PlayerData playerData;
 
     Vec2 size(64, 64);
@@ -403,6 +424,7 @@ int main(int argc, char* argv[])
 
 	DEBUG_PRINT("Starting game loop!");
     auto clock = chrono::system_clock::now();
+    const auto outputBudget = chrono::milliseconds(4);
 
     bool shouldBreak = false;
     long frame = 0;
@@ -800,8 +822,10 @@ int main(int argc, char* argv[])
 
         k = EKey::G;
 
-        //Handle output
-        if (game.HasNextOutput())
+        //Handle output - everything that's waiting, so a burst doesn't trickle in a frame at a time, but
+        //stop once the budget is spent and pick the rest up next frame
+        auto outputStart = chrono::steady_clock::now();
+        while (game.HasNextOutput() && chrono::steady_clock::now() - outputStart < outputBudget)
         {
             ROGUE_PROFILE_SECTION("Handle Output");
             Output output = game.PopNextOutput();
@@ -812,10 +836,17 @@ int main(int argc, char* argv[])
                 gameReady = true;
                 break;
             case ViewUpdated:
-                playerData.UpdateViewPlayer(output.Get<ViewUpdated>());
+                if (!playerData.UpdateViewPlayer(output.Get<ViewUpdated>()))
+                {
+                    PRINT_ERR("Game sent a view update that doesn't decode - disconnecting");
+                    game.Disconnect();
+                }
                 break;
             case RecievePath:
-                lastPath = output.Get<RecievePath>()->m_offsets;
+                lastPath = output.Get<RecievePath>().m_offsets;
+                break;
+            case SaveFinished:
+                DEBUG_PRINT("Saved %s: %s", output.Get<SaveFinished>().m_fileName.c_str(), output.Get<SaveFinished>().m_success ? "done" : "failed");
                 break;
             default:
                 // Unhandled case! Either invalid, or this output type needs to be handled.
@@ -922,9 +953,18 @@ int main(int argc, char* argv[])
         ROGUE_PROFILE_FRAME();
     }
 
-    //Cleanup phase
-    game.CreateInput<SaveAndExit>();
-    gameThread.join();
+    //Cleanup phase - a server keeps running without us, unless we told it to stop
+    if (!remoteMode)
+    {
+        game.CreateInput<SaveAndExit>();
+
+        //Keep taking outputs until it's done - the last save reports back through them, and a full queue would stall it
+        while (localGame.WaitForOutput())
+        {
+            localGame.PopNextOutput();
+        }
+        gameThread.join();
+    }
     terminal_close();
 	Resources::Shutdown();
     Jobs::Shutdown();